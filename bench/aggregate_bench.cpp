@@ -0,0 +1,97 @@
+// Aggregate benchmark: min/max/sum/avg over one large array of samples.
+//
+// Parses a document holding a single array of numbers, which the parser
+// stores packed, and evaluates each aggregate with every reduction kernel
+// the CPU supports. For comparison, the same samples are also evaluated as
+// an array of JSONValues, which takes the element-by-element path with a
+// type check per element. Reports the best throughput in million
+// elements per second.
+//
+// Usage: ./bench/aggregate_bench [element_count]
+
+#include "../json_eval_internal.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+static std::string makeSamples(size_t count) {
+    std::string text = "[";
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) text += ',';
+        text += std::to_string((i * 7919) % 100003) + "." + std::to_string(i % 97);
+    }
+    text += "]";
+    return text;
+}
+
+static const char* levelName(SIMDLevel level) {
+    switch (level) {
+        case SIMDLevel::Scalar: return "scalar";
+        case SIMDLevel::SSE2: return "sse2";
+        case SIMDLevel::AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+static double bestRate(BuiltinFunction function, const JSONValue& samples, double& result) {
+    double best = 0;
+    for (int run = 0; run < 5; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        result = callBuiltin(function, &samples, 1).numberValue;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::max(best, samples.arrayValue().size() / elapsed.count() / 1e6);
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+
+    Arena arena;
+    std::string text = makeSamples(count);
+    JSONParser parser(text, arena);
+    JSONValue packed = parser.parse();
+    if (!packed.arrayValue().isPacked()) {
+        std::printf("samples were not packed\n");
+        return 1;
+    }
+
+    // The same samples as individual JSONValues
+    JSONValue* items = arena.allocateArray<JSONValue>(count);
+    for (size_t i = 0; i < count; ++i) {
+        items[i] = packed.arrayValue()[i];
+    }
+    JSONValue unpacked(items, count);
+
+    const std::pair<const char*, BuiltinFunction> functions[] = {
+        {"min", BuiltinFunction::Min},
+        {"max", BuiltinFunction::Max},
+        {"sum", BuiltinFunction::Sum},
+        {"avg", BuiltinFunction::Avg},
+    };
+    SIMDLevel detected = detectSIMDLevel();
+    const SIMDLevel levels[] = {SIMDLevel::Scalar, SIMDLevel::SSE2, SIMDLevel::AVX2};
+    std::printf("elements=%zu\n", count);
+    bool mismatch = false;
+    for (const auto& function : functions) {
+        double expected = 0;
+        std::printf("  %s  values %8.0f M/s", function.first, bestRate(function.second, unpacked, expected));
+        for (SIMDLevel level : levels) {
+            if (level > detected) break;
+            selectReductions(level);
+            double result = 0;
+            std::printf("  %s %8.0f M/s", levelName(level), bestRate(function.second, packed, result));
+
+            // Sums are reassociated, so allow for rounding differences
+            mismatch = mismatch || std::fabs(result - expected) > 1e-9 * std::fabs(expected);
+        }
+        std::printf("\n");
+    }
+    if (mismatch) {
+        std::printf("packed and unpacked results differ\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Depth-scaling benchmark: parse and serialization cost per value as the
+// nesting depth grows.
+//
+// For each depth, builds a document of about the same size made of chains
+// of containers nested that deep, alternating objects and arrays around a
+// number: [{"a": [{"a": [... 7 ...]}]}, ...]. Each chain holds depth + 1
+// values. If every value is handled a constant number of times, the time
+// per value stays flat across depths; a parser that copies subtrees as it
+// unwinds would instead grow with the depth. The parser and writer keep
+// their own stacks, so depths far beyond what recursion on the native
+// stack survives are measured too.
+//
+// Usage: ./bench/depth_bench [megabytes] [max_depth]
+
+#include "../json_eval_internal.h"
+#include "timing.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Chains of `depth` containers until the text reaches `targetBytes`;
+// `values` is set to the number of values in the document
+static std::string makeDocument(size_t depth, size_t targetBytes, size_t& values) {
+    std::string chain;
+    for (size_t level = 0; level < depth; ++level) chain += level % 2 == 0 ? "{\"a\": " : "[";
+    chain += "7";
+    for (size_t level = depth; level-- > 0;) chain += level % 2 == 0 ? "}" : "]";
+
+    std::string text = "[";
+    values = 1;
+    for (size_t i = 0; text.size() < targetBytes; ++i) {
+        if (i > 0) text += ", ";
+        text += chain;
+        values += depth + 1;
+    }
+    text += "]";
+    return text;
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 32;
+    size_t maxDepth = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1 << 20;
+    maxNestingDepth() = maxDepth + 1; // the chains sit in one more array
+
+    std::printf("%8s %12s %10s %12s %12s\n", "depth", "values", "MB/s", "parse ns/v", "write ns/v");
+    for (size_t depth = 1; depth <= maxDepth; depth *= 4) {
+        size_t values = 0;
+        std::string text = makeDocument(depth, megabytes << 20, values);
+
+        double parseSeconds = bestSeconds(3, [&]() {
+            Arena arena;
+            JSONParser parser(text, arena);
+            parser.parse();
+        });
+
+        Arena arena;
+        JSONParser parser(text, arena);
+        JSONValue root = parser.parse();
+        double writeSeconds = bestSeconds(3, [&]() {
+            JSONWriter writer;
+            writer.write(root);
+        });
+
+        std::printf("%8zu %12zu %10.1f %12.2f %12.2f\n", depth, values,
+                    text.size() / parseSeconds / (1024.0 * 1024.0), parseSeconds * 1e9 / values,
+                    writeSeconds * 1e9 / values);
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+// Writes a deterministic benchmark document to stdout.
+//
+// Usage: ./bench/generate <kind> <megabytes> [seed]
+// Kinds: records, deep, wide, numbers, strings, ndjson
+
+#include "generator.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::fprintf(stderr, "Usage: ./bench/generate <kind> <megabytes> [seed]\nKinds:");
+        for (const char* kind : documentKinds) std::fprintf(stderr, " %s", kind);
+        std::fprintf(stderr, "\n");
+        return 1;
+    }
+    size_t megabytes = std::strtoull(argv[2], nullptr, 10);
+    uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1;
+
+    DocumentGenerator generator(seed);
+    std::string text;
+    if (!generator.generate(argv[1], megabytes << 20, text)) {
+        std::fprintf(stderr, "Unknown document kind: %s\n", argv[1]);
+        return 1;
+    }
+    return std::fwrite(text.data(), 1, text.size(), stdout) == text.size() ? 0 : 1;
+}
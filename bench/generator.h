@@ -0,0 +1,168 @@
+// Deterministic generators for benchmark documents.
+//
+// Every generator produces the same bytes for the same kind, size and seed
+// on every platform: random choices come from a SplitMix64 sequence and
+// numbers are formatted with integer arithmetic only. Documents are JSON
+// objects (so expressions can reach into them by name) except "ndjson",
+// which is one record object per line.
+
+#ifndef JSON_EVAL_BENCH_GENERATOR_H
+#define JSON_EVAL_BENCH_GENERATOR_H
+
+#include <cstdint>
+#include <string>
+
+// Kinds of document generateDocument() knows
+static const char* const documentKinds[] = {"records", "deep", "wide", "numbers", "strings", "ndjson"};
+
+class DocumentGenerator {
+public:
+    explicit DocumentGenerator(uint64_t seed) : state(seed) {}
+
+    // Next number of the SplitMix64 sequence
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t below(uint64_t bound) { return next() % bound; }
+
+    // Array of objects shaped like typical API records:
+    // {"items": [{"id", "user": {...}, "price", "tags"}, ...], "count": n}
+    std::string records(size_t targetBytes) {
+        std::string text = "{\"items\": [";
+        size_t count = 0;
+        for (; text.size() < targetBytes; ++count) {
+            if (count > 0) text += ", ";
+            appendRecord(text, count);
+        }
+        text += "], \"count\": " + std::to_string(count) + "}";
+        return text;
+    }
+
+    // Records one per line, for --ndjson
+    std::string ndjson(size_t targetBytes) {
+        std::string text;
+        for (size_t i = 0; text.size() < targetBytes; ++i) {
+            appendRecord(text, i);
+            text += '\n';
+        }
+        return text;
+    }
+
+    // Subtrees 128 levels deep, alternating objects and arrays:
+    // {"items": [{"a": [{"a": [... {"value": n} ...]}]}, ...]}
+    std::string deep(size_t targetBytes) {
+        const size_t depth = 64;
+        std::string text = "{\"items\": [";
+        for (size_t i = 0; text.size() < targetBytes; ++i) {
+            if (i > 0) text += ", ";
+            for (size_t level = 0; level < depth; ++level) text += "{\"a\": [";
+            text += "{\"value\": " + std::to_string(below(1000000)) + "}";
+            for (size_t level = 0; level < depth; ++level) text += "]}";
+        }
+        text += "]}";
+        return text;
+    }
+
+    // Objects with 1000 members each: {"objects": [{"f0": ..., "f999": ...}, ...]}
+    std::string wide(size_t targetBytes) {
+        const size_t members = 1000;
+        std::string text = "{\"objects\": [";
+        for (size_t i = 0; text.size() < targetBytes; ++i) {
+            if (i > 0) text += ", ";
+            text += '{';
+            for (size_t m = 0; m < members; ++m) {
+                if (m > 0) text += ", ";
+                text += "\"f" + std::to_string(m) + "\": ";
+                if (m % 2 == 0) {
+                    text += std::to_string(below(100000));
+                } else {
+                    text += "\"v" + std::to_string(below(100000)) + "\"";
+                }
+            }
+            text += '}';
+        }
+        text += "]}";
+        return text;
+    }
+
+    // One huge array of integers, decimals and exponents: {"values": [...]}
+    std::string numbers(size_t targetBytes) {
+        std::string text = "{\"values\": [";
+        for (size_t i = 0; text.size() < targetBytes; ++i) {
+            if (i > 0) text += ", ";
+            switch (below(4)) {
+                case 0: text += std::to_string(below(1000000)); break;
+                case 1: appendDecimal(text, below(10000000), 3); break;
+                case 2: appendDecimal(text, below(100000000000000000ull), 15); break;
+                default:
+                    appendDecimal(text, below(100000), 2);
+                    text += "e" + std::to_string(static_cast<int>(below(40)) - 20);
+            }
+        }
+        text += "]}";
+        return text;
+    }
+
+    // Long strings of words with occasional escapes: {"texts": ["...", ...]}
+    std::string strings(size_t targetBytes) {
+        static const char* const words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+                                            "adipiscing", "elit", "sed", "do", "eiusmod", "tempor",
+                                            "\\\"quoted\\\"", "back\\\\slash", "incididunt", "labore"};
+        std::string text = "{\"texts\": [";
+        for (size_t i = 0; text.size() < targetBytes; ++i) {
+            if (i > 0) text += ", ";
+            text += '"';
+            size_t length = 200 + below(3800);
+            for (size_t start = text.size(); text.size() - start < length;) {
+                text += words[below(sizeof(words) / sizeof(words[0]))];
+                text += ' ';
+            }
+            text += '"';
+        }
+        text += "]}";
+        return text;
+    }
+
+    // Document of `kind`; false if there is no such kind
+    bool generate(const std::string& kind, size_t targetBytes, std::string& text) {
+        if (kind == "records") text = records(targetBytes);
+        else if (kind == "ndjson") text = ndjson(targetBytes);
+        else if (kind == "deep") text = deep(targetBytes);
+        else if (kind == "wide") text = wide(targetBytes);
+        else if (kind == "numbers") text = numbers(targetBytes);
+        else if (kind == "strings") text = strings(targetBytes);
+        else return false;
+        return true;
+    }
+
+private:
+    uint64_t state;
+
+    // mantissa * 10^-decimals, written without floating point
+    static void appendDecimal(std::string& text, uint64_t mantissa, int decimals) {
+        std::string digits = std::to_string(mantissa);
+        if (digits.size() <= static_cast<size_t>(decimals)) {
+            digits.insert(0, decimals + 1 - digits.size(), '0');
+        }
+        text += digits.substr(0, digits.size() - decimals) + "." + digits.substr(digits.size() - decimals);
+    }
+
+    void appendRecord(std::string& text, size_t id) {
+        text += "{\"id\": " + std::to_string(id) + ", \"user\": {\"name\": \"user" + std::to_string(below(1000000)) +
+                "\", \"age\": " + std::to_string(18 + below(60)) + ", \"email\": \"user" + std::to_string(id) +
+                "@example.com\", \"scores\": [";
+        for (int s = 0; s < 5; ++s) {
+            if (s > 0) text += ", ";
+            text += std::to_string(below(101));
+        }
+        text += "]}, \"price\": ";
+        appendDecimal(text, below(100000), 2);
+        text += ", \"tags\": [\"t" + std::to_string(below(50)) + "\", \"t" + std::to_string(below(50)) + "\"]}";
+    }
+};
+
+#endif // JSON_EVAL_BENCH_GENERATOR_H
@@ -0,0 +1,154 @@
+// Query latency through the library (json_eval.h) against running the
+// json_eval command for each query.
+//
+// Writes a generated records document to a temporary file, then answers
+// a few queries against it four ways: running ./json_eval once per query,
+// as callers without the library have to; loading the document and
+// compiling the query in process for each query; compiling each query
+// against a document loaded once; and evaluating a query compiled once.
+// The command's output is checked against the library's results first.
+// Finally several threads evaluate the same queries against the same
+// document at once, and their results are checked too. Uses nothing but
+// the library interface, and is linked against libjson_eval.a.
+//
+// Usage: ./bench/library_bench [megabytes] [threads] [json_eval]
+
+#include "../json_eval.h"
+#include "generator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char* const queries[] = {
+    "count",
+    "items[1000].user.name",
+    "max(items[42].user.scores) - min(items[42].user.scores)",
+    "items[10].price * (1 + 0.2) - 5",
+};
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Mean microseconds per call of `op`, over at least `minimumSeconds`
+template <typename Op>
+static double microsPerOp(double minimumSeconds, Op op) {
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do {
+        op();
+        ++calls;
+        elapsed = seconds(start);
+    } while (elapsed < minimumSeconds);
+    return elapsed * 1e6 / calls;
+}
+
+// Standard output of `jsonEval path expression`; empty if it fails
+static std::string runCommand(const std::string& jsonEval, const std::string& path, const char* expression) {
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0) return std::string();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(pipeFds[1], STDOUT_FILENO);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        execl(jsonEval.c_str(), jsonEval.c_str(), path.c_str(), expression, static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(pipeFds[1]);
+    std::string output;
+    char buffer[4096];
+    ssize_t count;
+    while ((count = read(pipeFds[0], buffer, sizeof(buffer))) > 0) output.append(buffer, count);
+    close(pipeFds[0]);
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return std::string();
+    }
+    return output;
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 16;
+    size_t threadCount = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4;
+    std::string jsonEval = argc > 3 ? argv[3] : "./json_eval";
+
+    char path[] = "/tmp/json_eval_library_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::fprintf(stderr, "Cannot create a temporary file\n");
+        return 1;
+    }
+    close(fd);
+    {
+        DocumentGenerator generator(1);
+        std::string text = generator.records(megabytes << 20);
+        std::ofstream file(path, std::ios::binary);
+        file.write(text.data(), text.size());
+    }
+
+    const size_t queryCount = sizeof(queries) / sizeof(queries[0]);
+    int status = 0;
+    try {
+        json_eval::Document document = json_eval::Document::load(path);
+        std::vector<json_eval::Query> compiled;
+        std::vector<std::string> expected;
+        for (const char* text : queries) {
+            compiled.push_back(json_eval::Query::compile(text));
+            expected.push_back(compiled.back().evaluate(document));
+            if (runCommand(jsonEval, path, text) != expected.back() + "\n") {
+                std::fprintf(stderr, "%s and the library disagree on %s\n", jsonEval.c_str(), text);
+                unlink(path);
+                return 1;
+            }
+        }
+
+        std::printf("%-60s %12s %12s %12s %12s\n", "query", "command us", "load us", "compile us", "evaluate us");
+        for (size_t i = 0; i < queryCount; ++i) {
+            double command = microsPerOp(2, [&]() { runCommand(jsonEval, path, queries[i]); });
+            double load = microsPerOp(2, [&]() {
+                json_eval::Query::compile(queries[i]).evaluate(json_eval::Document::load(path));
+            });
+            double compile = microsPerOp(0.5, [&]() { json_eval::Query::compile(queries[i]).evaluate(document); });
+            double evaluate = microsPerOp(0.5, [&]() { compiled[i].evaluate(document); });
+            std::printf("%-60s %12.1f %12.1f %12.2f %12.3f\n", queries[i], command, load, compile, evaluate);
+        }
+
+        // Every thread evaluates every query against the shared document
+        const size_t rounds = 100000;
+        std::atomic<bool> mismatch(false);
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < threadCount; ++t) {
+            threads.emplace_back([&]() {
+                for (size_t round = 0; round < rounds; ++round) {
+                    size_t i = round % queryCount;
+                    if (compiled[i].evaluate(document) != expected[i]) mismatch = true;
+                }
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+        double elapsed = seconds(start);
+        if (mismatch) {
+            std::fprintf(stderr, "Concurrent evaluations gave different results\n");
+            status = 1;
+        }
+        std::printf("%zu threads: %.0f evaluations per second in total\n", threadCount,
+                    threadCount * rounds / elapsed);
+    } catch (const json_eval::Error& ex) {
+        std::fprintf(stderr, "%s\n", ex.what());
+        status = 1;
+    }
+    unlink(path);
+    return status;
+}
@@ -0,0 +1,91 @@
+// Memory-per-element benchmark for the parsed JSON representation.
+//
+// Builds a few synthetic documents in memory, parses each one and reports
+// how much resident memory the parsed tree occupies per element. The input
+// text is allocated before the baseline is taken and the parser's scratch
+// space is freed before the second reading, so the delta is the tree itself.
+//
+// Usage: ./bench/memory_bench [element_count]
+
+#include "../json_eval_internal.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <malloc.h>
+#include <unistd.h>
+
+// Layout of JSONValue before the tagged-union rewrite, kept for comparison
+struct LegacyJSONValue {
+    JSONValueType type;
+    std::unordered_map<std::string, LegacyJSONValue*> objectValue;
+    std::vector<LegacyJSONValue*> arrayValue;
+    std::string stringValue;
+    double numberValue;
+};
+
+// Current resident set size in bytes
+static size_t residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t totalPages = 0, residentPages = 0;
+    statm >> totalPages >> residentPages;
+    return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+static std::string makeNumberArray(size_t count) {
+    std::string text = "[";
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) text += ',';
+        text += std::to_string(i % 1000) + ".5";
+    }
+    text += "]";
+    return text;
+}
+
+static std::string makeStringArray(size_t count) {
+    std::string text = "[";
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) text += ',';
+        text += "\"item" + std::to_string(i % 1000) + "\"";
+    }
+    text += "]";
+    return text;
+}
+
+static std::string makeObjectArray(size_t count) {
+    std::string text = "[";
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) text += ',';
+        text += "{\"id\":" + std::to_string(i) + ",\"price\":9.99,\"name\":\"Widget\"}";
+    }
+    text += "]";
+    return text;
+}
+
+static void measure(const char* name, const std::string& text, size_t elements) {
+    malloc_trim(0);
+    size_t before = residentBytes();
+    Arena arena;
+    JSONValue root;
+    {
+        JSONParser parser(text, arena);
+        root = parser.parse();
+    }
+    malloc_trim(0);
+    size_t after = residentBytes();
+    double perElement = after > before ? static_cast<double>(after - before) / elements : 0.0;
+    std::printf("%-14s elements=%zu rss_delta=%zu bytes_per_element=%.1f\n",
+                name, elements, after - before, perElement);
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+    std::printf("sizeof(JSONValue)=%zu sizeof(LegacyJSONValue)=%zu\n",
+                sizeof(JSONValue), sizeof(LegacyJSONValue));
+
+    measure("numbers", makeNumberArray(count), count);
+    measure("strings", makeStringArray(count), count);
+    measure("objects", makeObjectArray(count / 4), count / 4);
+    return 0;
+}
@@ -0,0 +1,122 @@
+// Object storage benchmark: flat JSONObject vs the node-based hash map it
+// replaced.
+//
+// For several object sizes, parses an array of objects with that many
+// members and copies each one into an std::unordered_map keyed the same
+// way. Reports the resident memory per object for both layouts and the
+// average time of a member lookup that hits, and of one that misses.
+//
+// Usage: ./bench/object_bench [total_members]
+
+#include "../json_eval_internal.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <malloc.h>
+#include <unistd.h>
+
+// Object layout before the flat rewrite, kept for comparison
+using LegacyJSONObject = std::unordered_map<KeyId, JSONValue>;
+
+// Current resident set size in bytes
+static size_t residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t totalPages = 0, residentPages = 0;
+    statm >> totalPages >> residentPages;
+    return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+static std::string makeObjects(size_t objectCount, size_t memberCount) {
+    std::string text = "[";
+    for (size_t i = 0; i < objectCount; ++i) {
+        if (i > 0) text += ',';
+        text += '{';
+        for (size_t m = 0; m < memberCount; ++m) {
+            if (m > 0) text += ',';
+            text += "\"field" + std::to_string(m) + "\":" + std::to_string(i + m);
+        }
+        text += '}';
+    }
+    text += "]";
+    return text;
+}
+
+// Average nanoseconds per call of lookup(object, key) over every object,
+// cycling through `keys`; the best of several runs
+template <typename Objects, typename Lookup>
+static double lookupNanos(const Objects& objects, const std::vector<KeyId>& keys, Lookup lookup) {
+    double best = 0;
+    for (int run = 0; run < 5; ++run) {
+        size_t found = 0;
+        size_t lookups = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < 4; ++round) {
+            for (size_t i = 0; i < objects.size(); ++i) {
+                found += lookup(objects[i], keys[(i + round) % keys.size()]) ? 1 : 0;
+                lookups++;
+            }
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        double nanos = elapsed.count() / lookups;
+        if (found == static_cast<size_t>(-1)) std::printf("unreachable\n");
+        best = run == 0 ? nanos : std::min(best, nanos);
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    size_t totalMembers = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+    const size_t memberCounts[] = {2, 4, 8, 16, 32, 128};
+
+    std::printf("%8s %12s %12s %10s %10s %10s %10s\n", "members", "flat_bytes", "map_bytes", "flat_hit",
+                "map_hit", "flat_miss", "map_miss");
+    for (size_t memberCount : memberCounts) {
+        size_t objectCount = totalMembers / memberCount;
+        std::string text = makeObjects(objectCount, memberCount);
+
+        // Flat objects, as the parser builds them
+        malloc_trim(0);
+        size_t before = residentBytes();
+        Arena arena;
+        JSONValue root;
+        {
+            JSONParser parser(text, arena);
+            root = parser.parse();
+        }
+        malloc_trim(0);
+        size_t flatBytes = residentBytes() - before;
+        std::vector<const JSONObject*> flat;
+        flat.reserve(objectCount);
+        for (const JSONValue& item : root.arrayValue()) {
+            flat.push_back(&item.objectValue());
+        }
+
+        // The same members in node-based maps
+        std::vector<LegacyJSONObject> legacy(objectCount);
+        malloc_trim(0);
+        before = residentBytes();
+        for (size_t i = 0; i < objectCount; ++i) {
+            legacy[i].reserve(memberCount);
+            for (size_t m = 0; m < flat[i]->size(); ++m) {
+                legacy[i].emplace(flat[i]->key(m), flat[i]->value(m));
+            }
+        }
+        size_t mapBytes = residentBytes() - before + objectCount * sizeof(LegacyJSONObject);
+
+        std::vector<KeyId> hits;
+        for (size_t m = 0; m < memberCount; ++m) {
+            hits.push_back(KeyTable::global().intern("field" + std::to_string(m)));
+        }
+        std::vector<KeyId> misses(1, KeyTable::global().intern(std::string("absent")));
+
+        auto findFlat = [](const JSONObject* obj, KeyId key) { return obj->find(key) != nullptr; };
+        auto findMap = [](const LegacyJSONObject& obj, KeyId key) { return obj.find(key) != obj.end(); };
+        std::printf("%8zu %12.1f %12.1f %8.1fns %8.1fns %8.1fns %8.1fns\n", memberCount,
+                    static_cast<double>(flatBytes) / objectCount, static_cast<double>(mapBytes) / objectCount,
+                    lookupNanos(flat, hits, findFlat), lookupNanos(legacy, hits, findMap),
+                    lookupNanos(flat, misses, findFlat), lookupNanos(legacy, misses, findMap));
+    }
+    return 0;
+}
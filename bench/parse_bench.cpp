@@ -0,0 +1,82 @@
+// Parse throughput benchmark: scalar scanning kernels vs SIMD kernels.
+//
+// Generates an indented document of records with string-heavy fields and
+// a numeric-heavy document, then parses each repeatedly with every
+// scanner the CPU supports and reports the best throughput in MB/s.
+//
+// Usage: ./bench/parse_bench [megabytes]
+
+#include "../json_eval_internal.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static std::string makeDocument(size_t targetBytes) {
+    std::string text = "[\n";
+    for (size_t i = 0; text.size() < targetBytes; ++i) {
+        if (i > 0) text += ",\n";
+        text += "    {\n";
+        text += "        \"id\": " + std::to_string(i) + ",\n";
+        text += "        \"name\": \"customer record number " + std::to_string(i) + "\",\n";
+        text += "        \"email\": \"customer" + std::to_string(i) + "@example.com\",\n";
+        text += "        \"note\": \"a somewhat longer free-text field with a \\\"quoted\\\" word in it\",\n";
+        text += "        \"tags\": [\"alpha\", \"beta\", \"gamma\"]\n";
+        text += "    }";
+    }
+    text += "\n]\n";
+    return text;
+}
+
+static std::string makeNumericDocument(size_t targetBytes) {
+    std::string text = "[";
+    for (size_t i = 0; text.size() < targetBytes; ++i) {
+        if (i > 0) text += ",";
+        text += std::to_string(i % 100000) + "." + std::to_string(i % 997);
+        if (i % 7 == 0) text += "e-3";
+    }
+    text += "]";
+    return text;
+}
+
+static const char* levelName(SIMDLevel level) {
+    switch (level) {
+        case SIMDLevel::Scalar: return "scalar";
+        case SIMDLevel::SSE2: return "sse2";
+        case SIMDLevel::AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+static double bestThroughput(const std::string& text, int runs) {
+    double best = 0;
+    for (int run = 0; run < runs; ++run) {
+        Arena arena;
+        auto start = std::chrono::steady_clock::now();
+        JSONParser parser(text, arena);
+        parser.parse();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::max(best, text.size() / elapsed.count() / (1024.0 * 1024.0));
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 64;
+    const std::pair<const char*, std::string> documents[] = {
+        {"records", makeDocument(megabytes * 1024 * 1024)},
+        {"numbers", makeNumericDocument(megabytes * 1024 * 1024)},
+    };
+
+    SIMDLevel detected = detectSIMDLevel();
+    const SIMDLevel levels[] = {SIMDLevel::Scalar, SIMDLevel::SSE2, SIMDLevel::AVX2};
+    for (const auto& document : documents) {
+        std::printf("%s: %zu bytes\n", document.first, document.second.size());
+        for (SIMDLevel level : levels) {
+            if (level > detected) break;
+            selectScanner(level);
+            std::printf("  %-7s %8.1f MB/s\n", levelName(level), bestThroughput(document.second, 5));
+        }
+    }
+    return 0;
+}
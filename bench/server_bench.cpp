@@ -0,0 +1,172 @@
+// Server query latency benchmark.
+//
+// Writes a synthetic document to a temporary file, starts
+// `json_eval --serve --socket` on it and connects several clients, plus
+// optionally some idle ones that connect and never send anything. Every
+// active client sends queries one at a time, cycling through a fixed set
+// of expressions, and waits for each answer before sending the next.
+// Reports the latency percentiles over all queries; the first query of the
+// run also pays for parsing the document. The server runs on as many
+// threads as there are active clients, so idle clients must not hold any
+// of them.
+//
+// Usage: ./bench/server_bench [queries_per_client] [clients] [idle_clients] [json_eval]
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static std::string makeDocument(size_t recordCount) {
+    std::string text = "{\"records\":[";
+    for (size_t i = 0; i < recordCount; ++i) {
+        if (i > 0) text += ',';
+        text += "{\"id\":" + std::to_string(i) + ",\"name\":\"user" + std::to_string(i) +
+                "\",\"scores\":[" + std::to_string(i % 100) + "," + std::to_string(i % 37) + "]}";
+    }
+    text += "],\"samples\":[";
+    for (size_t i = 0; i < recordCount; ++i) {
+        if (i > 0) text += ',';
+        text += std::to_string(i % 1000) + ".5";
+    }
+    text += "]}";
+    return text;
+}
+
+static const char* const expressionSet[] = {
+    "records[0].name",
+    "records[1000].scores[1] * 2",
+    "max(records[42].scores) - min(records[42].scores)",
+    "size(records)",
+    "sum(samples)",
+};
+
+// Connected socket, or -1 if nothing listens at `path`
+static int connectTo(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Read one answer line into `answer`; false if the connection closed first
+static bool readLine(int fd, std::string& buffer, std::string& answer) {
+    size_t newline;
+    while ((newline = buffer.find('\n')) == std::string::npos) {
+        char chunk[4096];
+        ssize_t count = read(fd, chunk, sizeof(chunk));
+        if (count <= 0) return false;
+        buffer.append(chunk, count);
+    }
+    answer.assign(buffer, 0, newline);
+    buffer.erase(0, newline + 1);
+    return true;
+}
+
+// Send `queryCount` queries and record how long each answer took
+static void runClient(int fd, const std::string& path, size_t queryCount, std::vector<double>& latencies) {
+    std::string buffer;
+    std::string answer;
+    for (size_t i = 0; i < queryCount; ++i) {
+        std::string query = path + "\t" + expressionSet[i % (sizeof(expressionSet) / sizeof(expressionSet[0]))] + "\n";
+        auto start = std::chrono::steady_clock::now();
+        if (write(fd, query.data(), query.size()) != static_cast<ssize_t>(query.size()) ||
+            !readLine(fd, buffer, answer)) {
+            std::printf("connection failed\n");
+            std::exit(1);
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        if (answer.compare(0, 6, "error:") == 0) {
+            std::printf("query failed: %s\n", answer.c_str());
+            std::exit(1);
+        }
+        latencies.push_back(elapsed.count());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t queryCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50000;
+    size_t clientCount = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4;
+    size_t idleCount = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 0;
+    std::string jsonEval = argc > 4 ? argv[4] : "./json_eval";
+
+    char path[] = "/tmp/server_bench_XXXXXX";
+    int documentFd = mkstemp(path);
+    std::string document = makeDocument(100000);
+    if (documentFd < 0 || write(documentFd, document.data(), document.size()) != static_cast<ssize_t>(document.size())) {
+        std::printf("cannot write %s\n", path);
+        return 1;
+    }
+    close(documentFd);
+
+    std::string socketPath = std::string(path) + ".sock";
+    std::string threads = std::to_string(clientCount);
+    pid_t server = fork();
+    if (server == 0) {
+        execl(jsonEval.c_str(), jsonEval.c_str(), "--serve", "--socket", socketPath.c_str(), "--threads",
+              threads.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    // Wait up to five seconds for the server to listen
+    std::vector<int> idleFds;
+    std::vector<int> clientFds;
+    for (int attempt = 0; attempt < 500 && clientFds.empty(); ++attempt) {
+        int fd = connectTo(socketPath);
+        if (fd >= 0) {
+            clientFds.push_back(fd);
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    while (idleFds.size() < idleCount) idleFds.push_back(connectTo(socketPath));
+    while (!clientFds.empty() && clientFds.size() < clientCount) clientFds.push_back(connectTo(socketPath));
+    bool connected = !clientFds.empty() && std::find(clientFds.begin(), clientFds.end(), -1) == clientFds.end() &&
+                     std::find(idleFds.begin(), idleFds.end(), -1) == idleFds.end();
+    if (!connected) {
+        std::printf("cannot connect to %s --serve\n", jsonEval.c_str());
+    }
+
+    std::vector<std::vector<double>> latencies(clientCount);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t c = 0; connected && c < clientCount; ++c) {
+        clients.emplace_back(runClient, clientFds[c], std::string(path), queryCount, std::ref(latencies[c]));
+    }
+    for (auto& client : clients) client.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (int fd : clientFds) close(fd);
+    for (int fd : idleFds) close(fd);
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+    }
+    unlink(socketPath.c_str());
+    unlink(path);
+    if (!connected) return 1;
+
+    std::vector<double> all;
+    for (const auto& client : latencies) all.insert(all.end(), client.begin(), client.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+    std::printf("clients=%zu idle=%zu queries=%zu document_bytes=%zu\n", clientCount, idleCount, all.size(),
+                document.size());
+    std::printf("  p50 %8.1fus  p90 %8.1fus  p99 %8.1fus  max %10.1fus  %10.0f queries/s\n", percentile(0.5),
+                percentile(0.9), percentile(0.99), all.back(), all.size() / elapsed.count());
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Compile-time queries (static_query.h) against the runtime expression path.
+//
+// Parses generated records once, then evaluates each query against every
+// record three ways: from the expression text on every call (lexing,
+// parsing, optimizing, compiling and running, as a caller without a cache
+// would), with the program compiled once and run on the VirtualMachine,
+// and with the equivalent static query. The results of all three are
+// checked to be equal on every record first; any difference exits with
+// status 1. Reports the best of several runs in nanoseconds per record.
+//
+// Usage: ./bench/static_bench [megabytes]
+
+#include "../static_query.h"
+#include "generator.h"
+#include "timing.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static bool sameResult(const JSONValue& a, const JSONValue& b) {
+    if (a.type != b.type) return false;
+    switch (a.type) {
+        case JSONValueType::Number: return a.numberValue == b.numberValue;
+        case JSONValueType::String: return a.stringValue() == b.stringValue();
+        default: {
+            JSONWriter left, right;
+            left.write(a);
+            right.write(b);
+            return left.text() == right.text();
+        }
+    }
+}
+
+static Program compile(const char* text, Arena& arena) {
+    Lexer lexer(text);
+    Parser parser(lexer, arena);
+    Optimizer optimizer(arena);
+    return Compiler::compile(optimizer.optimize(parser.parseExpression()));
+}
+
+// Checks and times `text` and its static equivalent `query`; false if their results differ
+template <typename StaticQuery>
+static bool benchmark(const char* text, const StaticQuery& query, const std::vector<JSONValue>& records) {
+    VirtualMachine vm;
+    Arena arena;
+    Program program = compile(text, arena);
+    for (const JSONValue& record : records) {
+        Arena textArena;
+        JSONValue fromText = vm.run(compile(text, textArena), record);
+        if (!sameResult(fromText, vm.run(program, record)) || !sameResult(fromText, query(record))) {
+            std::fprintf(stderr, "Results differ for %s\n", text);
+            return false;
+        }
+    }
+
+    // Text is compiled on every call, so it runs on a tenth of the records
+    size_t textRecords = std::max<size_t>(records.size() / 10, 1);
+    double textSeconds = bestSeconds(3, [&]() {
+        for (size_t i = 0; i < textRecords; ++i) {
+            Arena callArena;
+            sink = vm.run(compile(text, callArena), records[i]).numberValue;
+        }
+    });
+    double programSeconds = bestSeconds(5, [&]() {
+        for (const JSONValue& record : records) sink = vm.run(program, record).numberValue;
+    });
+    double staticSeconds = bestSeconds(5, [&]() {
+        for (const JSONValue& record : records) sink = query(record).numberValue;
+    });
+
+    std::printf("%-44s %12.1f %12.1f %12.1f\n", text, textSeconds * 1e9 / textRecords,
+                programSeconds * 1e9 / records.size(), staticSeconds * 1e9 / records.size());
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 16;
+
+    DocumentGenerator generator(1);
+    std::string text = generator.ndjson(megabytes << 20);
+    Arena documents;
+    std::vector<JSONValue> records;
+    for (size_t start = 0; start < text.size();) {
+        size_t end = text.find('\n', start);
+        JSONParser parser(text.data() + start, end - start, documents);
+        records.push_back(parser.parse());
+        start = end + 1;
+    }
+
+    using namespace static_query;
+    std::printf("%zu records\n%-44s %12s %12s %12s\n", records.size(), "query", "text ns", "program ns",
+                "static ns");
+    bool ok = benchmark("user.scores[2]", path("user", "scores", 2), records) &&
+              benchmark("max(user.scores) - min(user.scores)",
+                        max(path("user", "scores")) - min(path("user", "scores")), records) &&
+              benchmark("avg(user.scores) + size(tags)", avg(path("user", "scores")) + size(path("tags")), records) &&
+              benchmark("price * (1 + 0.2) - user[\"age\"] / 2",
+                        path("price") * (1 + 0.2) - path("user", key("age")) / 2, records) &&
+              benchmark("sum(user.scores[0], user.scores[4], -id)",
+                        sum(path("user", "scores", 0), path("user", "scores", 4), -path("id")), records);
+    return ok ? 0 : 1;
+}
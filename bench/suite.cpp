@@ -0,0 +1,263 @@
+// Benchmark suite for tracking performance between commits.
+//
+// Macro benchmarks run ./json_eval end to end on generated documents
+// written to a temporary directory, and take each run's peak resident
+// memory from the kernel. Micro benchmarks then time each stage in process
+// on the same documents: JSON parsing, expression lexing and parsing,
+// compilation, evaluation and serialization. Documents come from generator.h with a
+// fixed seed, so every run measures the same input.
+//
+// Results are printed one per line as JSON objects,
+//   {"benchmark": "parse/records", "unit": "MB/s", "value": 512.3}
+// so they can be collected and compared by a script. Throughput is the
+// best of several runs; per-operation times repeat the operation for at
+// least 0.2 s and keep the best of three such rounds.
+//
+// Usage: ./bench/suite [--scale MB] [--json-eval PATH]
+
+#include "../json_eval_internal.h"
+#include "generator.h"
+#include "timing.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static void report(const std::string& benchmark, const char* unit, double value) {
+    std::printf("{\"benchmark\": \"%s\", \"unit\": \"%s\", \"value\": %.6g}\n", benchmark.c_str(), unit, value);
+    std::fflush(stdout);
+}
+
+// Nanoseconds per call of `op`
+template <typename Op>
+static double nanosPerOp(Op op) {
+    double best = 0;
+    for (int round = 0; round < 3; ++round) {
+        size_t calls = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+        do {
+            for (int i = 0; i < 64; ++i) op();
+            calls += 64;
+            elapsed = seconds(start);
+        } while (elapsed < 0.2);
+        double nanos = elapsed * 1e9 / calls;
+        best = round == 0 ? nanos : std::min(best, nanos);
+    }
+    return best;
+}
+
+static double megabytesPerSecond(size_t bytes, double elapsed) {
+    return bytes / elapsed / (1024.0 * 1024.0);
+}
+
+static void parseBenchmarks(const std::map<std::string, std::string>& documents) {
+    for (const auto& document : documents) {
+        const std::string& text = document.second;
+        double elapsed;
+        if (document.first == "ndjson") {
+            // One record at a time into a reused arena, as --ndjson does
+            elapsed = bestSeconds(3, [&]() {
+                Arena arena;
+                JSONParser parser(nullptr, 0, arena);
+                for (size_t start = 0; start < text.size();) {
+                    size_t end = text.find('\n', start);
+                    arena.reset();
+                    parser.reset(text.data() + start, end - start);
+                    sink = static_cast<double>(parser.parse().type);
+                    start = end + 1;
+                }
+            });
+        } else {
+            elapsed = bestSeconds(3, [&]() {
+                Arena arena;
+                JSONParser parser(text, arena);
+                sink = static_cast<double>(parser.parse().type);
+            });
+        }
+        report("parse/" + document.first, "MB/s", megabytesPerSecond(text.size(), elapsed));
+    }
+}
+
+static const char* const expressionSet[] = {
+    "items[1000].user.name",
+    "items[10].price * (1 + 0.2) - 5",
+    "max(items[42].user.scores) - min(items[42].user.scores)",
+    "avg(items[7].user.scores) + size(items[7].tags)",
+    "items[3][\"user\"][\"scores\"][items[3].user.scores[0] / 101]",
+    "sum(items[?price > 500].price)",
+};
+
+static void expressionBenchmarks(const JSONValue& records) {
+    // Lexing and parsing only
+    size_t next = 0;
+    const size_t count = sizeof(expressionSet) / sizeof(expressionSet[0]);
+    report("expression/parse", "ns/op", nanosPerOp([&]() {
+        Arena arena;
+        Lexer lexer(expressionSet[next++ % count]);
+        Parser parser(lexer, arena);
+        sink = static_cast<double>(parser.parseExpression()->kind);
+    }));
+
+    // Parsing, optimizing and compiling
+    report("expression/compile", "ns/op", nanosPerOp([&]() {
+        Arena arena;
+        Lexer lexer(expressionSet[next++ % count]);
+        Parser parser(lexer, arena);
+        Optimizer optimizer(arena);
+        sink = static_cast<double>(Compiler::compile(optimizer.optimize(parser.parseExpression())).code.size());
+    }));
+
+    // Each compiled expression against the parsed document
+    Arena arena;
+    VirtualMachine vm;
+    for (size_t i = 0; i < count; ++i) {
+        Lexer lexer(expressionSet[i]);
+        Parser parser(lexer, arena);
+        Optimizer optimizer(arena);
+        Program program = Compiler::compile(optimizer.optimize(parser.parseExpression()));
+        report("evaluate/" + std::to_string(i), "ns/op", nanosPerOp([&]() {
+            sink = static_cast<double>(vm.run(program, records).type);
+        }));
+    }
+}
+
+static void serializeBenchmarks(const std::map<std::string, std::string>& documents) {
+    const char* const kinds[] = {"records", "numbers", "strings"};
+    const std::pair<const char*, JSONWriter::Style> styles[] = {
+        {"spaced", JSONWriter::Style::Spaced},
+        {"compact", JSONWriter::Style::Compact},
+        {"pretty", JSONWriter::Style::Pretty},
+    };
+    for (const char* kind : kinds) {
+        Arena arena;
+        JSONParser parser(documents.at(kind), arena);
+        JSONValue root = parser.parse();
+        for (const auto& style : styles) {
+            size_t bytes = 0;
+            double elapsed = bestSeconds(3, [&]() {
+                JSONWriter writer(nullptr, style.second);
+                writer.write(root);
+                bytes = writer.text().size();
+            });
+            report(std::string("serialize/") + kind + "/" + style.first, "MB/s", megabytesPerSecond(bytes, elapsed));
+        }
+    }
+}
+
+// Runs json_eval with `args` (output discarded) three times and reports
+// the fastest run's wall time, input throughput and peak resident memory
+static bool runCommand(const std::string& name, const std::string& jsonEval, const std::vector<std::string>& args,
+                       size_t inputBytes) {
+    double best = 0;
+    long bestRss = 0;
+    for (int run = 0; run < 3; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid = fork();
+        if (pid == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            std::vector<char*> argv;
+            argv.push_back(const_cast<char*>(jsonEval.c_str()));
+            for (const std::string& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+            argv.push_back(nullptr);
+            execv(jsonEval.c_str(), argv.data());
+            _exit(127);
+        }
+        int status = 0;
+        rusage usage;
+        if (pid < 0 || wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::fprintf(stderr, "%s: json_eval failed\n", name.c_str());
+            return false;
+        }
+        double elapsed = seconds(start);
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+            bestRss = usage.ru_maxrss;
+        }
+    }
+    report("cli/" + name + "/wall", "ms", best * 1e3);
+    report("cli/" + name + "/throughput", "MB/s", megabytesPerSecond(inputBytes, best));
+    report("cli/" + name + "/peak_rss", "KB", static_cast<double>(bestRss));
+    return true;
+}
+
+// Run before anything large is allocated: a child's peak resident memory
+// starts from its parent's at the time of the fork
+static bool commandBenchmarks(size_t scale, const std::string& jsonEval) {
+    char directory[] = "/tmp/json_eval_suite_XXXXXX";
+    if (!mkdtemp(directory)) {
+        std::fprintf(stderr, "Cannot create a temporary directory\n");
+        return false;
+    }
+    std::map<std::string, std::string> paths;
+    std::map<std::string, size_t> sizes;
+    for (const char* kind : documentKinds) {
+        std::string text;
+        DocumentGenerator generator(1);
+        generator.generate(kind, scale << 20, text);
+        paths[kind] = std::string(directory) + "/" + kind + ".json";
+        sizes[kind] = text.size();
+        std::ofstream file(paths[kind], std::ios::binary);
+        file.write(text.data(), text.size());
+    }
+
+    bool ok =
+        runCommand("records", jsonEval, {paths["records"], "items[1000].user.name"}, sizes["records"]) &&
+        runCommand("records_lazy", jsonEval, {"--lazy", paths["records"], "items[1000].user.name"}, sizes["records"]) &&
+        runCommand("records_output", jsonEval, {"--compact", paths["records"], "items"}, sizes["records"]) &&
+        runCommand("numbers_sum", jsonEval, {paths["numbers"], "sum(values)"}, sizes["numbers"]) &&
+        runCommand("wide", jsonEval, {paths["wide"], "objects[10].f999"}, sizes["wide"]) &&
+        runCommand("deep", jsonEval, {paths["deep"], "items[0].a[0].a[0]"}, sizes["deep"]) &&
+        runCommand("ndjson", jsonEval, {"--ndjson", paths["ndjson"], "user.age * 2"}, sizes["ndjson"]) &&
+        runCommand("ndjson_threads", jsonEval, {"--ndjson", "--threads", "0", paths["ndjson"], "user.age * 2"},
+                   sizes["ndjson"]) &&
+        // The first run writes the cache, the faster ones read it
+        runCommand("records_cache", jsonEval, {"--cache", paths["records"], "items[1000].user.name"},
+                   sizes["records"]);
+
+    for (const auto& path : paths) unlink(path.second.c_str());
+    unlink((paths["records"] + ".cache").c_str());
+    rmdir(directory);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    size_t scale = 16;
+    std::string jsonEval = "./json_eval";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+        if (option == "--scale") {
+            scale = std::strtoull(argv[i + 1], nullptr, 10);
+        } else if (option == "--json-eval") {
+            jsonEval = argv[i + 1];
+        } else {
+            std::fprintf(stderr, "Usage: ./bench/suite [--scale MB] [--json-eval PATH]\n");
+            return 1;
+        }
+    }
+
+    bool ok = commandBenchmarks(scale, jsonEval);
+
+    std::map<std::string, std::string> documents;
+    for (const char* kind : documentKinds) {
+        DocumentGenerator generator(1);
+        generator.generate(kind, scale << 20, documents[kind]);
+    }
+
+    parseBenchmarks(documents);
+    {
+        Arena arena;
+        JSONParser parser(documents.at("records"), arena);
+        expressionBenchmarks(parser.parse());
+    }
+    serializeBenchmarks(documents);
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    report("suite/peak_rss", "KB", static_cast<double>(usage.ru_maxrss));
+    return ok ? 0 : 1;
+}
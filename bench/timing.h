@@ -0,0 +1,30 @@
+// Timing helpers shared by the benchmarks.
+
+#ifndef JSON_EVAL_BENCH_TIMING_H
+#define JSON_EVAL_BENCH_TIMING_H
+
+#include <algorithm>
+#include <chrono>
+
+// Keeps a result alive so the work producing it is not optimized away
+static volatile double sink;
+
+// Seconds since `start`
+static inline double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Shortest of `runs` calls of `run`, in seconds
+template <typename Run>
+static double bestSeconds(int runs, Run run) {
+    double best = 0;
+    for (int i = 0; i < runs; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        double elapsed = seconds(start);
+        best = i == 0 ? elapsed : std::min(best, elapsed);
+    }
+    return best;
+}
+
+#endif
@@ -0,0 +1,240 @@
+// Evaluation throughput benchmark: AST tree-walker vs compiled bytecode.
+//
+// Parses a set of synthetic records once, then evaluates a fixed set of
+// expressions against every record, first by walking the expression trees
+// the way the evaluator used to, then with compiled programs on the
+// VirtualMachine, and finally with programs compiled from optimized trees.
+// All three resolve shared path prefixes per record. Reports the best of
+// several runs in records per second.
+//
+// Usage: ./bench/vm_bench [record_count]
+
+#include "../json_eval_internal.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// The previous evaluator, kept for comparison: it identifies each node
+// with a chain of dynamic_casts, recurses for every subexpression and
+// resolves member names to keys on every lookup
+class TreeWalker {
+public:
+    TreeWalker(const JSONValue& root, const SharedPaths* paths, const ResolvedPaths* resolved)
+        : root(root), paths(paths), resolved(resolved) {}
+
+    JSONValue evaluate(Expression* expr) {
+        if (size_t node = paths->nodeOf(expr)) {
+            if (const JSONValue* shared = resolved->value(node)) {
+                return *shared;
+            }
+        }
+
+        if (auto numExpr = dynamic_cast<NumberExpr*>(expr)) {
+            return JSONValue(numExpr->value);
+        } else if (auto strExpr = dynamic_cast<StringExpr*>(expr)) {
+            return JSONValue(StringRef(strExpr->value));
+        } else if (auto idExpr = dynamic_cast<IdentifierExpr*>(expr)) {
+            if (root.type != JSONValueType::Object) {
+                throw std::runtime_error("Root is not an object");
+            }
+            const JSONValue* value = root.objectValue().find(KeyTable::global().find(idExpr->name));
+            if (!value) {
+                throw std::runtime_error("Identifier not found: " + idExpr->name);
+            }
+            return *value;
+        } else if (auto binExpr = dynamic_cast<BinaryOpExpr*>(expr)) {
+            JSONValue left = evaluate(binExpr->left);
+            JSONValue right = evaluate(binExpr->right);
+            if (left.type != JSONValueType::Number || right.type != JSONValueType::Number) {
+                throw std::runtime_error("Arithmetic operations require number operands");
+            }
+            switch (binExpr->op) {
+                case '+': return JSONValue(left.numberValue + right.numberValue);
+                case '-': return JSONValue(left.numberValue - right.numberValue);
+                case '*': return JSONValue(left.numberValue * right.numberValue);
+                default:
+                    if (right.numberValue == 0) throw std::runtime_error("Division by zero");
+                    return JSONValue(left.numberValue / right.numberValue);
+            }
+        } else if (auto unaryExpr = dynamic_cast<UnaryOpExpr*>(expr)) {
+            JSONValue operand = evaluate(unaryExpr->operand);
+            if (operand.type != JSONValueType::Number) {
+                throw std::runtime_error("Unary operator requires a number operand");
+            }
+            return JSONValue(-operand.numberValue);
+        } else if (auto funcExpr = dynamic_cast<FunctionCallExpr*>(expr)) {
+            std::vector<JSONValue> args;
+            args.reserve(funcExpr->arguments.size());
+            for (auto argExpr : funcExpr->arguments) {
+                args.push_back(evaluate(argExpr));
+            }
+            BuiltinFunction function;
+            if (!findBuiltin(funcExpr->functionName, function)) {
+                throw std::runtime_error("Unknown function: " + funcExpr->functionName);
+            }
+            return callBuiltin(function, args.data(), args.size());
+        } else if (auto subExpr = dynamic_cast<SubscriptExpr*>(expr)) {
+            JSONValue base = evaluate(subExpr->base);
+            JSONValue index = evaluate(subExpr->index);
+            if (base.type == JSONValueType::Array) {
+                if (index.type != JSONValueType::Number) {
+                    throw std::runtime_error("Array index must be a number");
+                }
+                int idx = static_cast<int>(index.numberValue);
+                if (idx < 0 || static_cast<size_t>(idx) >= base.arrayValue().size()) {
+                    throw std::runtime_error("Array index out of bounds");
+                }
+                return base.arrayValue()[idx];
+            } else if (base.type == JSONValueType::Object) {
+                if (index.type != JSONValueType::String) {
+                    throw std::runtime_error("Object key must be a string");
+                }
+                const JSONValue* value = base.objectValue().find(KeyTable::global().find(index.stringValue()));
+                if (!value) {
+                    throw std::runtime_error("Key not found in object");
+                }
+                return *value;
+            }
+            throw std::runtime_error("Subscript operator applied to non-array/object");
+        } else if (auto memberExpr = dynamic_cast<MemberAccessExpr*>(expr)) {
+            JSONValue base = evaluate(memberExpr->base);
+            if (base.type != JSONValueType::Object) {
+                throw std::runtime_error("Member access applied to non-object");
+            }
+            const JSONValue* value = base.objectValue().find(KeyTable::global().find(memberExpr->member));
+            if (!value) {
+                throw std::runtime_error("Member not found in object");
+            }
+            return *value;
+        }
+        throw std::runtime_error("Unknown expression type");
+    }
+
+private:
+    const JSONValue& root;
+    const SharedPaths* paths;
+    const ResolvedPaths* resolved;
+};
+
+static std::string makeRecord(size_t i) {
+    return "{\"id\":" + std::to_string(i) +
+           ",\"user\":{\"name\":\"user" + std::to_string(i) + "\",\"age\":" + std::to_string(20 + i % 50) +
+           ",\"scores\":[" + std::to_string(i % 100) + "," + std::to_string(i % 37) + "," +
+           std::to_string(i % 71) + "," + std::to_string(i % 13) + "]}" +
+           ",\"products\":[{\"price\":" + std::to_string(i % 90) + ".5},{\"price\":9.99},{\"price\":" +
+           std::to_string(i % 40) + ".25}],\"weights\":[1,2,3]}";
+}
+
+static const char* const expressionSet[] = {
+    "user.age + 5",
+    "max(user.scores) - min(user.scores)",
+    "(user.scores[0] + user.scores[1] + user.scores[2]) / 3",
+    "products[2].price * 2 - products[0].price",
+    "user.scores[weights[1]]",
+    "size(user.name) + -id",
+    "user[\"age\"] * (60 * 60 * 24) + size(\"seconds\")",
+};
+
+// Consumes a result so the evaluation cannot be optimized away
+static double checksum(const JSONValue& value) {
+    return value.type == JSONValueType::Number ? value.numberValue : static_cast<double>(value.type);
+}
+
+template <typename Evaluate>
+static double bestRate(size_t recordCount, Evaluate evaluate, double& sum) {
+    double best = 0;
+    for (int run = 0; run < 5; ++run) {
+        sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < recordCount; ++i) {
+            sum += evaluate(i);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::max(best, recordCount / elapsed.count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    size_t recordCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+
+    // Every record stays parsed for the whole benchmark
+    Arena documentArena;
+    std::vector<JSONValue> records;
+    records.reserve(recordCount);
+    for (size_t i = 0; i < recordCount; ++i) {
+        std::string text = makeRecord(i);
+        char* copy = static_cast<char*>(documentArena.allocate(text.size(), 1));
+        std::memcpy(copy, text.data(), text.size());
+        JSONParser parser(copy, text.size(), documentArena);
+        records.push_back(parser.parse());
+    }
+
+    // The optimizer rewrites trees in place, so it gets its own copies
+    Arena expressionArena;
+    Optimizer optimizer(expressionArena);
+    std::vector<Expression*> expressions;
+    std::vector<Expression*> optimizedExpressions;
+    for (const char* text : expressionSet) {
+        Lexer lexer(text);
+        Parser parser(lexer, expressionArena);
+        expressions.push_back(parser.parseExpression());
+        Lexer optimizedLexer(text);
+        Parser optimizedParser(optimizedLexer, expressionArena);
+        optimizedExpressions.push_back(optimizer.optimize(optimizedParser.parseExpression()));
+    }
+    SharedPaths paths(expressions);
+    std::vector<Program> programs;
+    for (Expression* expr : expressions) {
+        programs.push_back(Compiler::compile(expr, &paths));
+    }
+    SharedPaths optimizedPaths(optimizedExpressions);
+    std::vector<Program> optimizedPrograms;
+    for (Expression* expr : optimizedExpressions) {
+        optimizedPrograms.push_back(Compiler::compile(expr, &optimizedPaths));
+    }
+
+    ResolvedPaths resolved;
+    double treeSum = 0;
+    double treeRate = bestRate(recordCount, [&](size_t i) {
+        paths.resolve(records[i], resolved);
+        TreeWalker walker(records[i], &paths, &resolved);
+        double sum = 0;
+        for (Expression* expr : expressions) {
+            sum += checksum(walker.evaluate(expr));
+        }
+        return sum;
+    }, treeSum);
+
+    VirtualMachine vm;
+    double vmSum = 0;
+    double vmRate = bestRate(recordCount, [&](size_t i) {
+        paths.resolve(records[i], resolved);
+        double sum = 0;
+        for (const Program& program : programs) {
+            sum += checksum(vm.run(program, records[i], &resolved));
+        }
+        return sum;
+    }, vmSum);
+
+    double optimizedSum = 0;
+    double optimizedRate = bestRate(recordCount, [&](size_t i) {
+        optimizedPaths.resolve(records[i], resolved);
+        double sum = 0;
+        for (const Program& program : optimizedPrograms) {
+            sum += checksum(vm.run(program, records[i], &resolved));
+        }
+        return sum;
+    }, optimizedSum);
+
+    std::printf("records=%zu expressions=%zu\n", recordCount, expressions.size());
+    std::printf("  tree-walker %12.0f records/s\n", treeRate);
+    std::printf("  bytecode    %12.0f records/s (%.2fx)\n", vmRate, vmRate / treeRate);
+    std::printf("  optimized   %12.0f records/s (%.2fx)\n", optimizedRate, optimizedRate / treeRate);
+    if (treeSum != vmSum || treeSum != optimizedSum) {
+        std::printf("  results differ: %g vs %g vs %g\n", treeSum, vmSum, optimizedSum);
+        return 1;
+    }
+    return 0;
+}
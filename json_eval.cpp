@@ -1,870 +1,227 @@
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <string>
-#include <cctype>
-#include <vector>
-#include <unordered_map>
-#include <stdexcept>
-#include <algorithm>
-#include <limits>
-
-// Forward declarations
-struct JSONValue;
-struct Expression;
-
-using JSONObject = std::unordered_map<std::string, JSONValue>;
-using JSONArray = std::vector<JSONValue>;
-
-enum class JSONValueType { Null, Object, Array, String, Number };
-
-struct JSONValue {
-    JSONValueType type = JSONValueType::Null;
-    JSONObject objectValue;
-    JSONArray arrayValue;
-    std::string stringValue;
-    double numberValue = 0;
-
-    // Default constructor
-    JSONValue() = default;
-
-    // Constructors for each type
-    JSONValue(double num) : type(JSONValueType::Number), numberValue(num) {}
-
-    JSONValue(const std::string& str) : type(JSONValueType::String), stringValue(str) {}
-
-    JSONValue(const JSONArray& arr) : type(JSONValueType::Array), arrayValue(arr) {}
-
-    JSONValue(const JSONObject& obj) : type(JSONValueType::Object), objectValue(obj) {}
-};
-
-// JSON Parser
-class JSONParser {
-public:
-    JSONParser(const std::string& text) : text(text), pos(0) {}
-
-    JSONValue parse() {
-        // Parse the JSON value
-        skipWhitespace();
-        JSONValue result = parseValue();
-        skipWhitespace();
-
-        // Check for extra data
-        if (pos != text.length()) {
-            throw std::runtime_error("Invalid JSON: Extra data after parsing");
-        }
-
-
-        return result;
-    }
-
-private:
-    std::string text;
-    size_t pos;
-
-    void skipWhitespace() {
-        while (pos < text.length() && isspace(text[pos])) {
-            pos++;
-        }
-    }
-
-    char peek() {
-        if (pos < text.length()) {
-            return text[pos];
-        }
-        return '\0';
-    }
-
-    char get() {
-        if (pos < text.length()) {
-            return text[pos++];
-        }
-        return '\0';
-    }
-
-    JSONValue parseValue() {
-        skipWhitespace();
-        char c = peek();
-
-        // Check the first character to determine the type of JSON value
-        if (c == '{') return parseObject();
-        if (c == '[') return parseArray();
-        if (c == '"') return parseString();
-        if (isdigit(c) || c == '-') return parseNumber();
-
-        // Check for unexpected character
-        throw std::runtime_error(std::string("Unexpected character in JSON: ") + c);
-    }
-
-    JSONValue parseObject() {
-        JSONObject obj;
-
-        // Consume '{'
-        get();
-        skipWhitespace();
-
-        // Check for empty object
-        if (peek() == '}') {
-            get();
-            return JSONValue(obj);
-        }
-
-        // Parse key-value pairs
-        while (true) {
-            // Parse key-value pair
-            skipWhitespace();
-            std::string key = parseString().stringValue;
-            skipWhitespace();
-
-            if (get() != ':') throw std::runtime_error("Expected ':' in object");
-            skipWhitespace();
-
-            JSONValue value = parseValue();
-            obj[key] = value;
-            skipWhitespace();
-            char c = get();
-            if (c == '}') break;
-            if (c != ',') throw std::runtime_error("Expected ',' in object");
-        }
-
-        return JSONValue(obj);
-    }
-
-    JSONValue parseArray() {
-        JSONArray arr;
-
-        // Consume '['
-        get();
-        skipWhitespace();
-
-        // Check for empty array
-        if (peek() == ']') {
-            get(); // consume ']'
-            return JSONValue(arr);
-        }
-
-        // Parse array elements
-        while (true) {
-            skipWhitespace();
-            JSONValue value = parseValue();
-            arr.push_back(value);
-            skipWhitespace();
-            char c = get();
-            if (c == ']') break;
-            if (c != ',') throw std::runtime_error("Expected ',' in array");
-        }
-
-        return JSONValue(arr);
-    }
-
-    JSONValue parseString() {
-        std::string result;
-
-        // Consume '"'
-        get();
-
-        // Parse string characters
-        while (true) {
-            char c = get();
-
-            // Check for end of string
-            if (c == '"') break;
-
-            // Handle escape characters
-            if (c == '\\') {
-                char next = get();
-                if (next == '"' || next == '\\' || next == '/') {
-                    result += next;
-                } else {
-                    throw std::runtime_error("Invalid escape character in string");
-                }
-            } else {
-                result += c;
-            }
-        }
+#include "json_eval.h"
+#include "json_eval_internal.h"
 
-        return JSONValue(result);
-    }
-
-    JSONValue parseNumber() {
-        size_t start = pos;
-
-        // Parse optional negative sign
-        if (peek() == '-') get();
-
-        // Parse integer part
-        while (isdigit(peek())) get();
+#include <sstream>
 
-        // Parse fractional part
-        if (peek() == '.') {
-            get();
-            while (isdigit(peek())) get();
-        }
+// Library interface, declared in json_eval.h
 
-        // Get the number string
-        std::string numStr = text.substr(start, pos - start);
+namespace json_eval {
 
-        // Convert to double the number string
-        return JSONValue(std::stod(numStr));
+inline JSONWriter::Style writerStyle(Format format) {
+    switch (format) {
+        case Format::Compact: return JSONWriter::Style::Compact;
+        case Format::Pretty: return JSONWriter::Style::Pretty;
+        default: return JSONWriter::Style::Spaced;
     }
-};
-
-// Lexer
-enum class TokenType {
-    Identifier, Number, String, LParen, RParen, LBracket, RBracket, Comma,
-    Dot, Plus, Minus, Asterisk, Slash, End
-};
-
-struct Token {
-    TokenType type;
-    std::string value;
-};
+}
 
-class Lexer {
+// Hands results and error messages on to an Output
+class OutputSink : public ResultSink {
 public:
-    Lexer(const std::string& text) : text(text), pos(0) {}
+    explicit OutputSink(Output& output) : output(output) {}
 
-    Token getNextToken() {
-        skipWhitespace();
-
-        // Check for end of text
-        if (pos >= text.length()) {
-            return Token{TokenType::End, ""};
-        }
-
-        // Check for identifiers
-        char c = peek();
-        if (isalpha(c) || c == '_') {
-            return identifier();
-        }
-
-        // Check for numbers
-        if (isdigit(c)) {
-            return number();
-        }
-
-        // Check for negative numbers or minus operator
-        if (c == '-') {
-            char nextChar = peekNextChar();
-            if (isdigit(nextChar) || nextChar == '.') {
-                return number();
-            } else {
-                pos++; // Consume '-'
-                return Token{TokenType::Minus, "-"};
-            }
-        }
-
-        // Check for strings
-        if (c == '"') {
-            return string();
-        }
-
-        // Check for single-character tokens
-        switch (c) {
-            case '+': pos++; return Token{TokenType::Plus, "+"};
-            case '*': pos++; return Token{TokenType::Asterisk, "*"};
-            case '/': pos++; return Token{TokenType::Slash, "/"};
-            case '(': pos++; return Token{TokenType::LParen, "("};
-            case ')': pos++; return Token{TokenType::RParen, ")"};
-            case '[': pos++; return Token{TokenType::LBracket, "["};
-            case ']': pos++; return Token{TokenType::RBracket, "]"};
-            case ',': pos++; return Token{TokenType::Comma, ","};
-            case '.': pos++; return Token{TokenType::Dot, "."};
-            default:
-                throw std::runtime_error(std::string("Unknown character in expression: ") + c);
-        }
-    }
+    void write(const char* data, size_t size) override { output.write(data, size); }
+    void error(const std::string& message) override { output.error(message); }
 
 private:
-    std::string text;
-    size_t pos;
-
-    char peek() {
-        if (pos < text.length()) {
-            return text[pos];
-        }
-        return '\0';
-    }
-
-    char peekNextChar() {
-        size_t nextPos = pos + 1;
-        if (nextPos < text.length()) {
-            return text[nextPos];
-        }
-        return '\0';
-    }
-
-    void skipWhitespace() {
-        while (pos < text.length() && isspace(text[pos])) {
-            pos++;
-        }
-    }
-
-    Token identifier() {
-        size_t start = pos;
-        while (isalnum(peek()) || peek() == '_') {
-            pos++;
-        }
-        return Token{TokenType::Identifier, text.substr(start, pos - start)};
-    }
-
-    Token number() {
-        size_t start = pos;
-
-        // Parse optional negative sign
-        if (peek() == '-') pos++;
-
-        // Parse integer part
-        while (isdigit(peek())) {
-            pos++;
-        }
-
-        // Parse fractional part
-        if (peek() == '.') {
-            pos++;
-            while (isdigit(peek())) {
-                pos++;
-            }
-        }
-
-        // Get the number string
-        return Token{TokenType::Number, text.substr(start, pos - start)};
-    }
-
-    Token string() {
-        std::string result;
-
-        // Consume '"'
-        get();
-
-        // Parse string characters
-        while (true) {
-            char c = get();
-            if (c == '"') break;
-
-            // Handle escape characters
-            if (c == '\\') {
-                char next = get();
-                if (next == '"' || next == '\\' || next == '/') {
-                    result += next;
-                } else {
-                    throw std::runtime_error("Invalid escape character in string");
-                }
-            } else {
-                result += c;
-            }
-        }
-
-        // Return the string token
-        return Token{TokenType::String, result};
-    }
-
-    char get() {
-        if (pos < text.length()) {
-            return text[pos++];
-        }
-        return '\0';
-    }
-};
-
-// Abstract Syntax Tree Nodes
-struct Expression {
-    // Base class for all expression nodes
-    virtual ~Expression() = default;
+    Output& output;
 };
 
-// Number expression
-struct NumberExpr : public Expression {
-    double value;
-    NumberExpr(double value) : value(value) {}
-};
-
-// String expression
-struct StringExpr : public Expression {
-    std::string value;
-    StringExpr(const std::string& value) : value(value) {}
-};
+Statistics::Statistics() : stats(new Stats()) {}
 
-// Identifier expression
-struct IdentifierExpr : public Expression {
-    std::string name;
-    IdentifierExpr(const std::string& name) : name(name) {}
-};
+Statistics::~Statistics() {}
 
-// Binary operation expression: left op right
-struct BinaryOpExpr : public Expression {
-    char op;
-    Expression* left;
-    Expression* right;
-    BinaryOpExpr(char op, Expression* left, Expression* right)
-        : op(op), left(left), right(right) {}
-};
-
-// Unary operation expression: op operand
-struct UnaryOpExpr : public Expression {
-    char op;
-    Expression* operand;
-    UnaryOpExpr(char op, Expression* operand) : op(op), operand(operand) {}
-};
-
-// Function call expression: functionName(expr1, expr2, ...)
-struct FunctionCallExpr : public Expression {
-    std::string functionName;
-    std::vector<Expression*> arguments;
-    FunctionCallExpr(const std::string& functionName, const std::vector<Expression*>& arguments)
-        : functionName(functionName), arguments(arguments) {}
-};
-
-// Subscript expression: base[index]
-struct SubscriptExpr : public Expression {
-    Expression* base;
-    Expression* index;
-    SubscriptExpr(Expression* base, Expression* index) : base(base), index(index) {}
-};
+bool Statistics::available() {
+    return JSON_EVAL_STATS != 0;
+}
 
-// Member access expression: base.member
-struct MemberAccessExpr : public Expression {
-    Expression* base;
-    std::string member;
-    MemberAccessExpr(Expression* base, const std::string& member) : base(base), member(member) {}
-};
+std::string Statistics::json() const {
+    std::ostringstream out;
+    stats->write(out);
+    return out.str();
+}
 
-// Parser
-class Parser {
-public:
-    // Construct the Parser with a Lexer
-    Parser(Lexer& lexer) : lexer(lexer) {
-        currentToken = lexer.getNextToken();
-    }
+Document::Document(std::shared_ptr<const ParsedDocument> parsed, CacheUse cached)
+    : parsed(std::move(parsed)), cached(cached) {}
 
-    // Parse the expression
-    Expression* parseExpression() {
-        return parseAddSubtract();
+Document Document::parse(std::string text) {
+    std::shared_ptr<ParsedDocument> document = std::make_shared<ParsedDocument>();
+    document->text = std::move(text);
+    try {
+        JSONParser parser(document->text, document->arena);
+        document->root = parser.parse();
+    } catch (const std::exception& ex) {
+        throw Error(Error::Kind::Json, std::string("JSON parsing error: ") + ex.what());
     }
+    return Document(document, CacheUse::None);
+}
 
-private:
-    Lexer& lexer;
-    Token currentToken;
-
-    // Consume the current token and move to the next one
-    void eat(TokenType type) {
-        if (currentToken.type == type) {
-            currentToken = lexer.getNextToken();
-        } else {
-            throw std::runtime_error("Unexpected token");
-        }
-    }
+Document Document::load(const std::string& path, const LoadOptions& options) {
+    Stats* stats = options.statistics ? options.statistics->stats.get() : nullptr;
+    std::shared_ptr<ParsedDocument> document = std::make_shared<ParsedDocument>();
 
-    // Parse addition and subtraction
-    Expression* parseAddSubtract() {
-        Expression* left = parseMultiplyDivide();
-        while (currentToken.type == TokenType::Plus || currentToken.type == TokenType::Minus) {
-            char op = (currentToken.type == TokenType::Plus) ? '+' : '-';
-            eat(currentToken.type);
-            Expression* right = parseMultiplyDivide();
-            left = new BinaryOpExpr(op, left, right);
+    // A current cache of the file stands in for parsing it
+    struct stat source;
+    std::string cachePath = path + ".cache";
+    if (options.cache) {
+        if (stat(path.c_str(), &source) != 0) {
+            throw Error(Error::Kind::Input, "Cannot open JSON file: " + path);
         }
-        return left;
+        document->cache = DocumentCache::open(cachePath, source);
     }
-
-    // Parse multiplication and division
-    Expression* parseMultiplyDivide() {
-        Expression* left = parseUnary();
-        while (currentToken.type == TokenType::Asterisk || currentToken.type == TokenType::Slash) {
-            char op = (currentToken.type == TokenType::Asterisk) ? '*' : '/';
-            eat(currentToken.type);
-            Expression* right = parseUnary();
-            left = new BinaryOpExpr(op, left, right);
-        }
-        return left;
+    if (document->cache) {
+        document->root = document->cache->root();
+        STATS_HOOK(stats, bytesRead += document->cache->size());
+        STATS_HOOK(stats, lap(Stats::Read));
+        return Document(document, CacheUse::Read);
     }
 
-    // Parse unary operators
-    Expression* parseUnary() {
-        if (currentToken.type == TokenType::Minus) {
-            eat(TokenType::Minus);
-            Expression* operand = parseUnary();
-            return new UnaryOpExpr('-', operand);
-        } else {
-            return parseSubscript();
-        }
+    // Parsed strings may point into the file, so it stays with the document
+    try {
+        document->file.reset(new MappedFile(path, options.map));
+    } catch (const std::exception& ex) {
+        throw Error(Error::Kind::Input, ex.what());
     }
+    STATS_HOOK(stats, bytesRead += document->file->size());
+    STATS_HOOK(stats, lap(Stats::Read));
 
-    // Parse subscripts and member access
-    Expression* parseSubscript() {
-        Expression* expr = parsePrimary();
-        while (true) {
-            if (currentToken.type == TokenType::LBracket) { // Parse subscript
-                eat(TokenType::LBracket);
-                Expression* index = parseExpression();
-                eat(TokenType::RBracket);
-                expr = new SubscriptExpr(expr, index);
-            } else if (currentToken.type == TokenType::Dot) { // Parse member access
-                eat(TokenType::Dot);
-                if (currentToken.type != TokenType::Identifier) {
-                    throw std::runtime_error("Expected identifier after '.'");
-                }
-                std::string member = currentToken.value;
-                eat(TokenType::Identifier);
-                expr = new MemberAccessExpr(expr, member);
-            } else {
-                break;
-            }
-        }
-        return expr;
+    // Parse either completely or only along the paths the expressions
+    // read; a document that is about to be cached is parsed completely. A
+    // mapped file is paged in while it is parsed.
+    const QuerySet* lazyFor = options.cache ? nullptr : options.lazyFor;
+    try {
+        JSONParser parser(document->file->data(), document->file->size(), document->arena, stats);
+        document->root = lazyFor ? parser.parse(lazyFor->compiled->access) : parser.parse();
+    } catch (const std::exception& ex) {
+        throw Error(Error::Kind::Json, std::string("JSON parsing error: ") + ex.what());
     }
-
-    Expression* parsePrimary() {
-        if (currentToken.type == TokenType::Number) { // Number
-            double value = std::stod(currentToken.value);
-            eat(TokenType::Number);
-            return new NumberExpr(value);
-        } else if (currentToken.type == TokenType::String) { // String
-            std::string value = currentToken.value;
-            eat(TokenType::String);
-            return new StringExpr(value);
-        } else if (currentToken.type == TokenType::Identifier) { // Identifier or function call
-            std::string name = currentToken.value;
-            eat(TokenType::Identifier);
-            if (currentToken.type == TokenType::LParen) {
-                // Function call
-                eat(TokenType::LParen);
-                std::vector<Expression*> args;
-                if (currentToken.type != TokenType::RParen) {
-                    do {
-                        Expression* arg = parseExpression();
-                        args.push_back(arg);
-                        if (currentToken.type == TokenType::Comma) {
-                            eat(TokenType::Comma);
-                        } else {
-                            break;
-                        }
-                    } while (true);
-                }
-                eat(TokenType::RParen);
-                return new FunctionCallExpr(name, args);
-            } else {
-                // Identifier
-                return new IdentifierExpr(name);
-            }
-        } else if (currentToken.type == TokenType::LParen) { // Parenthesized expression
-            eat(TokenType::LParen);
-            Expression* expr = parseExpression();
-            eat(TokenType::RParen);
-            return expr;
-        } else {
-            throw std::runtime_error("Invalid expression");
-        }
+    STATS_HOOK(stats, lap(Stats::Parse));
+    STATS_HOOK(stats, countArena(document->arena));
+    if (!options.cache) {
+        return Document(document, CacheUse::None);
     }
-};
-
-// Evaluator
-class Evaluator {
-public:
-    Evaluator(const JSONValue& root) : root(root) {}
-
-    JSONValue evaluate(Expression* expr) {
-        if (auto numExpr = dynamic_cast<NumberExpr*>(expr)) { // Number
-            return JSONValue(numExpr->value);
-        } else if (auto strExpr = dynamic_cast<StringExpr*>(expr)) { // String
-            return JSONValue(strExpr->value);
-        } else if (auto idExpr = dynamic_cast<IdentifierExpr*>(expr)) { // Identifier
-            return getIdentifierValue(idExpr->name);
-        } else if (auto binExpr = dynamic_cast<BinaryOpExpr*>(expr)) { // Binary operation
-            JSONValue leftVal = evaluate(binExpr->left);
-            JSONValue rightVal = evaluate(binExpr->right);
-
-            // Check for operands of type number
-            if (leftVal.type != JSONValueType::Number || rightVal.type != JSONValueType::Number) {
-                throw std::runtime_error("Arithmetic operations require number operands");
-            }
-
-            // Perform the operation
-            double leftNum = leftVal.numberValue;
-            double rightNum = rightVal.numberValue;
-            double result;
-            switch (binExpr->op) {
-                case '+': result = leftNum + rightNum; break;
-                case '-': result = leftNum - rightNum; break;
-                case '*': result = leftNum * rightNum; break;
-                case '/':
-                    if (rightNum == 0) throw std::runtime_error("Division by zero");
-                    result = leftNum / rightNum; break;
-                default:
-                    throw std::runtime_error("Unknown binary operator");
-            }
-
-            // Return the result
-            return JSONValue(result);
-        } else if (auto unaryExpr = dynamic_cast<UnaryOpExpr*>(expr)) { // Unary operation
-            // Evaluate the operand
-            JSONValue operandVal = evaluate(unaryExpr->operand);
-
-            // Check for operand of type number
-            if (operandVal.type != JSONValueType::Number) {
-                throw std::runtime_error("Unary operator requires a number operand");
-            }
-
-            // Perform the operation
-            double operandNum = operandVal.numberValue;
-            double result;
-            switch (unaryExpr->op) {
-                case '-': result = -operandNum; break;
-                default:
-                    throw std::runtime_error("Unknown unary operator");
-            }
-
-            // Return the result
-            return JSONValue(result);
-        } else if (auto funcExpr = dynamic_cast<FunctionCallExpr*>(expr)) {
-            // Evaluate function arguments
-            std::vector<JSONValue> args;
-            for (auto argExpr : funcExpr->arguments) {
-                args.push_back(evaluate(argExpr));
-            }
-
-            // Call the function
-            return evaluateFunction(funcExpr->functionName, args);
-        } else if (auto subExpr = dynamic_cast<SubscriptExpr*>(expr)) {
-            // Evaluate the base and index expressions
-            JSONValue baseVal = evaluate(subExpr->base);
-            JSONValue indexVal = evaluate(subExpr->index);
-
-            // Check for base value of type array or object
-            if (baseVal.type == JSONValueType::Array) {
-                // Check for index value of type number
-                if (indexVal.type != JSONValueType::Number) {
-                    throw std::runtime_error("Array index must be a number");
-                }
-
-                // Check for valid index
-                int idx = static_cast<int>(indexVal.numberValue);
-                if (idx < 0 || idx >= baseVal.arrayValue.size()) {
-                    throw std::runtime_error("Array index out of bounds");
-                }
-            
-                // Return the array element
-                return baseVal.arrayValue[idx];
-            } else if (baseVal.type == JSONValueType::Object) {
-                // Check for index value of type string
-                if (indexVal.type != JSONValueType::String) {
-                    throw std::runtime_error("Object key must be a string");
-                }
-
-                // Check for key in object
-                auto it = baseVal.objectValue.find(indexVal.stringValue);
-                if (it == baseVal.objectValue.end()) {
-                    throw std::runtime_error("Key not found in object");
-                }
-
-                // Return the object value
-                return it->second;
-            } else {
-                // Base value is not an array or object
-                throw std::runtime_error("Subscript operator applied to non-array/object");
-            }
-        } else if (auto memberExpr = dynamic_cast<MemberAccessExpr*>(expr)) {
-            // Evaluate the base expression
-            JSONValue baseVal = evaluate(memberExpr->base);
-
-            // Check for base value of type object
-            if (baseVal.type != JSONValueType::Object) {
-                throw std::runtime_error("Member access applied to non-object");
-            }
-
-            // Check for member in object
-            auto it = baseVal.objectValue.find(memberExpr->member);
-            if (it != baseVal.objectValue.end()) {
-                return it->second;
-            } else {
-                throw std::runtime_error("Member not found in object");
-            }
-        } else {
-            throw std::runtime_error("Unknown expression type");
-        }
-    }
-
-private:
-    const JSONValue& root;
-
-    JSONValue getIdentifierValue(const std::string& name) {
-        // Start from the root object
-        if (root.type != JSONValueType::Object) {
-            throw std::runtime_error("Root is not an object");
-        }
+    bool written = DocumentCache::write(cachePath, document->root, source);
+    STATS_HOOK(stats, lap(Stats::Output));
+    return Document(document, written ? CacheUse::Written : CacheUse::Failed);
+}
 
-        // Find the identifier in the root object
-        auto it = root.objectValue.find(name);
-        if (it != root.objectValue.end()) {
-            return it->second;
-        } else {
-            throw std::runtime_error("Identifier not found: " + name);
-        }
+std::string Document::json(Format format) const {
+    JSONWriter writer(nullptr, writerStyle(format));
+    try {
+        writer.write(parsed->root);
+    } catch (const std::exception& ex) {
+        throw Error(Error::Kind::Evaluation, std::string("Evaluation error: ") + ex.what());
     }
+    return writer.text();
+}
 
-    JSONValue evaluateFunction(const std::string& name, const std::vector<JSONValue>& args) {
-        if (name == "min") { // min function
-            if (args.empty()) {
-                throw std::runtime_error("min() requires at least one argument");
-            }
-
-            // Find the minimum value
-            double minVal = std::numeric_limits<double>::infinity();
-            for (const auto& arg : args) {
-                if (arg.type == JSONValueType::Array) { // Array argument
-                    for (const auto& item : arg.arrayValue) {
-                        if (item.type != JSONValueType::Number) {
-                            throw std::runtime_error("min() array items must be numbers");
-                        }
-                        minVal = std::min(minVal, item.numberValue);
-                    }
-                } else if (arg.type == JSONValueType::Number) { // Number argument
-                    minVal = std::min(minVal, arg.numberValue);
-                } else {
-                    throw std::runtime_error("min() arguments must be numbers or arrays of numbers");
-                }
-            }
-
-            // Return the minimum value
-            return JSONValue(minVal);
-        } else if (name == "max") { // max function
-            if (args.empty()) {
-                throw std::runtime_error("max() requires at least one argument");
-            }
-
-            // Find the maximum value
-            double maxVal = -std::numeric_limits<double>::infinity();
-            for (const auto& arg : args) {
-                if (arg.type == JSONValueType::Array) { // Array argument
-                    for (const auto& item : arg.arrayValue) {
-                        if (item.type != JSONValueType::Number) {
-                            throw std::runtime_error("max() array items must be numbers");
-                        }
-                        maxVal = std::max(maxVal, item.numberValue);
-                    }
-                } else if (arg.type == JSONValueType::Number) { // Number argument
-                    maxVal = std::max(maxVal, arg.numberValue);
-                } else {
-                    throw std::runtime_error("max() arguments must be numbers or arrays of numbers");
-                }
-            }
-
-            // Return the maximum value
-            return JSONValue(maxVal);
-        } else if (name == "size") {
-            // Check for exactly one argument
-            if (args.size() != 1) {
-                throw std::runtime_error("size() requires exactly one argument");
-            }
+Query::Query(std::shared_ptr<const CompiledExpression> compiled) : compiled(std::move(compiled)) {}
 
-            // Get the size of the argument
-            const auto& arg = args[0];
-            if (arg.type == JSONValueType::Object) {
-                return JSONValue(static_cast<double>(arg.objectValue.size()));
-            } else if (arg.type == JSONValueType::Array) {
-                return JSONValue(static_cast<double>(arg.arrayValue.size()));
-            } else if (arg.type == JSONValueType::String) {
-                return JSONValue(static_cast<double>(arg.stringValue.length()));
-            } else {
-                throw std::runtime_error("size() argument must be object, array, or string");
-            }
-        } else {
-            throw std::runtime_error("Unknown function: " + name);
-        }
+Query Query::compile(const std::string& expression) {
+    std::shared_ptr<CompiledExpression> result = std::make_shared<CompiledExpression>();
+    compileExpression(expression, *result);
+    if (!result->error.empty()) {
+        throw Error(Error::Kind::Expression, result->error);
     }
-};
+    return Query(result);
+}
 
-// Output JSON value
-void outputResult(const JSONValue& value, bool isRoot = true) {
-    switch (value.type) {
-        case JSONValueType::Null:
-            std::cout << "null";
-            break;
-        case JSONValueType::Number:
-            std::cout << value.numberValue;
-            break;
-        case JSONValueType::String:
-            std::cout << "\"" << value.stringValue << "\"";
-            break;
-        case JSONValueType::Array:
-            std::cout << "[ ";
-            for (size_t i = 0; i < value.arrayValue.size(); ++i) {
-                if (i > 0) std::cout << ", ";
-                outputResult(value.arrayValue[i], false);
-            }
-            std::cout << " ]";
-            break;
-        case JSONValueType::Object:
-            std::cout << "{ ";
-            size_t count = 0;
-            for (const auto& pair : value.objectValue) {
-                if (count > 0) std::cout << ", ";
-                std::cout << "\"" << pair.first << "\": ";
-                outputResult(pair.second, false);
-                count++;
-            }
-            std::cout << " }";
-            break;
+// One machine per thread, so evaluations share nothing that changes
+inline JSONValue evaluateCompiled(const CompiledExpression& compiled, const ParsedDocument& document) {
+    static thread_local VirtualMachine vm;
+    try {
+        return vm.run(compiled.program, document.root);
+    } catch (const std::exception& ex) {
+        throw Error(Error::Kind::Evaluation, std::string("Evaluation error: ") + ex.what());
     }
+}
 
-    if (isRoot) {
-        std::cout << std::endl;
+std::string Query::evaluate(const Document& document, Format format) const {
+    JSONWriter writer(nullptr, writerStyle(format));
+    JSONValue result = evaluateCompiled(*compiled, *document.parsed);
+    try {
+        writer.write(result);
+    } catch (const std::exception& ex) {
+        throw Error(Error::Kind::Evaluation, std::string("Evaluation error: ") + ex.what());
     }
+    return writer.text();
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: ./json_eval <json_file> <expression>" << std::endl;
-        return 1;
+double Query::evaluateNumber(const Document& document) const {
+    JSONValue result = evaluateCompiled(*compiled, *document.parsed);
+    if (result.type != JSONValueType::Number) {
+        throw Error(Error::Kind::Evaluation, "Evaluation error: Result is not a number");
     }
-    std::string jsonFilename = argv[1];
-    std::string expressionText = argv[2];
+    return result.numberValue;
+}
 
-    // Read JSON file
-    std::ifstream jsonFile(jsonFilename);
-    if (!jsonFile) {
-        std::cerr << "Error: Cannot open JSON file: " << jsonFilename << std::endl;
-        return 1;
-    }
-    std::stringstream buffer;
-    buffer << jsonFile.rdbuf();
-    std::string jsonText = buffer.str();
+QuerySet::QuerySet(std::shared_ptr<const CompiledQuerySet> compiled) : compiled(std::move(compiled)) {}
+
+QuerySet QuerySet::compile(const std::vector<std::string>& expressions, Statistics* statistics) {
+    std::shared_ptr<CompiledQuerySet> compiled = std::make_shared<CompiledQuerySet>();
+
+    // Parse and optimize every expression, then compile them against the
+    // paths they share
+    Optimizer optimizer(compiled->arena);
+    std::vector<Expression*> optimized;
+    optimized.reserve(expressions.size());
+    for (size_t i = 0; i < expressions.size(); ++i) {
+        Expression* expr;
+        try {
+            Lexer lexer(expressions[i]);
+            Parser parser(lexer, compiled->arena);
+            expr = parser.parseExpression();
+        } catch (const std::exception& ex) {
+            throw Error(Error::Kind::Expression,
+                        expressionLabel(i, expressions.size()) + "Expression parsing error: " + ex.what());
+        }
+        try {
+            optimized.push_back(optimizer.optimize(expr));
+        } catch (const std::exception& ex) {
+            throw Error(Error::Kind::Expression,
+                        expressionLabel(i, expressions.size()) + "Expression error: " + ex.what());
+        }
+        collectValueAccess(optimized.back(), compiled->access);
+    }
+    compiled->set.reset(new CompiledSet(optimized));
+    if (statistics) {
+        STATS_HOOK(statistics->stats, lap(Stats::Expressions));
+        STATS_HOOK(statistics->stats, countArena(compiled->arena));
+    }
+    return QuerySet(compiled);
+}
 
-    // Parse JSON
-    JSONValue root;
-    try {
-        JSONParser parser(jsonText);
-        root = parser.parse();
-    } catch (const std::exception& ex) {
-        std::cerr << "JSON parsing error: " << ex.what() << std::endl;
-        return 1;
-    }
+size_t QuerySet::size() const {
+    return compiled->set->programs.size();
+}
 
-    // Parse expression
-    Expression* expr = nullptr;
-    try {
-        Lexer lexer(expressionText);
-        Parser parser(lexer);
-        expr = parser.parseExpression();
-    } catch (const std::exception& ex) {
-        std::cerr << "Expression parsing error: " << ex.what() << std::endl;
-        return 1;
-    }
+bool QuerySet::evaluate(const Document& document, Output& output, const EvaluateOptions& options) const {
+    Stats* stats = options.statistics ? options.statistics->stats.get() : nullptr;
+    OutputSink sink(output);
+    JSONWriter out(&sink, writerStyle(options.format));
+    return evaluateDocument(*compiled->set, document.parsed->root, options.threads, out, writerStyle(options.format),
+                            stats);
+}
 
-    // Evaluate expression
-    JSONValue result = JSONValue();
+bool QuerySet::evaluateRecords(int fd, Output& output, const EvaluateOptions& options) const {
+    Stats* stats = options.statistics ? options.statistics->stats.get() : nullptr;
+    OutputSink sink(output);
+    const AccessTree* access = options.lazy ? &compiled->access : nullptr;
     try {
-        Evaluator evaluator(root);
-        result = evaluator.evaluate(expr);
+        if (options.threads > 1) {
+            return evaluateRecordsParallel(fd, *compiled->set, access, options.threads, sink,
+                                           writerStyle(options.format));
+        }
+        return ::evaluateRecords(fd, *compiled->set, access, sink, writerStyle(options.format), stats);
+    } catch (const Error&) {
+        throw;
     } catch (const std::exception& ex) {
-        std::cerr << "Evaluation error: " << ex.what() << std::endl;
-        return 1;
+        throw Error(Error::Kind::Input, ex.what());
     }
+}
 
-    // Output result
-    outputResult(result);
-
-    // Clean up
-    delete expr;
-    return 0;
+void setMaxDepth(size_t depth) {
+    maxNestingDepth() = depth;
 }
+
+} // namespace json_eval
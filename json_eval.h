@@ -0,0 +1,199 @@
+// Library interface of the JSON expression evaluator.
+//
+// Link with libjson_eval.a or libjson_eval.so to parse documents and
+// evaluate expressions in process, without running the json_eval command:
+//
+//     json_eval::Document document = json_eval::Document::load("data.json");
+//     json_eval::Query query = json_eval::Query::compile("max(user.scores) - min(user.scores)");
+//     std::string result = query.evaluate(document);
+//
+// Documents and queries are immutable once created and cheap to copy;
+// copies share the parsed data. Any number of threads may evaluate any
+// queries against any documents at the same time. Failures throw
+// json_eval::Error with the message the command would print. QuerySet
+// evaluates several expressions at once, against a document or a stream
+// of NDJSON records, and is what the json_eval command is built on.
+//
+// Object keys, and the member names in queries, are numbered in one table
+// shared by the whole process. Each distinct key is kept there until the
+// process exits, even after every document using it is gone, and parsing
+// or compiling fails with "Too many distinct object keys" once 2^26 (about
+// 67 million) distinct keys exist. Documents that use data as keys, such
+// as ids, should not be loaded without bound in a long-running process.
+
+#ifndef JSON_EVAL_H
+#define JSON_EVAL_H
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define JSON_EVAL_API __attribute__((visibility("default")))
+
+// Defined by the library
+struct ParsedDocument;
+struct CompiledExpression;
+struct CompiledQuerySet;
+struct Stats;
+
+namespace json_eval {
+
+class JSON_EVAL_API Error : public std::runtime_error {
+public:
+    // What failed: reading a file or input stream, parsing JSON, compiling
+    // an expression or evaluating one
+    enum class Kind { Input, Json, Expression, Evaluation };
+
+    Error(Kind kind, const std::string& message) : std::runtime_error(message), errorKind(kind) {}
+
+    Kind kind() const { return errorKind; }
+
+private:
+    Kind errorKind;
+};
+
+// How results are written as JSON text, as with --compact and --pretty
+enum class Format { Spaced, Compact, Pretty };
+
+// Receives the results of a QuerySet in order: result text in whole lines,
+// and a message without a newline for each expression or record that
+// fails, after the results before it
+class JSON_EVAL_API Output {
+public:
+    virtual ~Output() {}
+    virtual void write(const char* data, size_t size) = 0;
+    virtual void error(const std::string& message) = 0;
+};
+
+// Phase times and counts of one run, collected by the calls it is passed
+// to, as json_eval --stats prints them. Only collected on one thread.
+class JSON_EVAL_API Statistics {
+public:
+    Statistics();
+    ~Statistics();
+
+    // False if the library was built without them (JSON_EVAL_STATS=0)
+    static bool available();
+
+    // The totals so far as one line of JSON, without a newline
+    std::string json() const;
+
+private:
+    friend class Document;
+    friend class QuerySet;
+    std::unique_ptr<Stats> stats;
+};
+
+class QuerySet;
+
+struct LoadOptions {
+    // Parse only the parts of the document these expressions read, as with
+    // --lazy; other expressions may then find members missing
+    const QuerySet* lazyFor = nullptr;
+
+    // Load the document from <path>.cache if that is current, and write
+    // it otherwise, as with --cache
+    bool cache = false;
+
+    // Map the file while the document lives rather than read it; the
+    // process gets SIGBUS if a mapped file is truncated meanwhile
+    bool map = true;
+
+    Statistics* statistics = nullptr;
+};
+
+class JSON_EVAL_API Document {
+public:
+    // How LoadOptions::cache was served
+    enum class CacheUse { None, Read, Written, Failed };
+
+    // Parse JSON text; the document keeps its own copy
+    static Document parse(std::string text);
+
+    // Parse the JSON file at `path`
+    static Document load(const std::string& path, const LoadOptions& options = LoadOptions());
+
+    // The whole document written as JSON
+    std::string json(Format format = Format::Spaced) const;
+
+    CacheUse cacheUse() const { return cached; }
+
+private:
+    friend class Query;
+    friend class QuerySet;
+    Document(std::shared_ptr<const ParsedDocument> parsed, CacheUse cached);
+
+    std::shared_ptr<const ParsedDocument> parsed;
+    CacheUse cached;
+};
+
+class JSON_EVAL_API Query {
+public:
+    // Parse, optimize and compile an expression once for any number of evaluations
+    static Query compile(const std::string& expression);
+
+    // The result written as JSON
+    std::string evaluate(const Document& document, Format format = Format::Spaced) const;
+
+    // The result, which must be a number
+    double evaluateNumber(const Document& document) const;
+
+private:
+    explicit Query(std::shared_ptr<const CompiledExpression> compiled);
+
+    std::shared_ptr<const CompiledExpression> compiled;
+};
+
+struct EvaluateOptions {
+    Format format = Format::Spaced;
+
+    // Threads to evaluate the expressions of a document, or the records of
+    // a stream, on; statistics are only collected with one
+    size_t threads = 1;
+
+    // Parse each record only along the paths the expressions read
+    bool lazy = false;
+
+    Statistics* statistics = nullptr;
+};
+
+// Several expressions evaluated together, as by the json_eval command:
+// their common path prefixes are looked up once per document or record,
+// and each result is written as one line
+class JSON_EVAL_API QuerySet {
+public:
+    // Compile every expression; a failure names the expression by its
+    // position ("Expression 2: ...") when there are several
+    static QuerySet compile(const std::vector<std::string>& expressions, Statistics* statistics = nullptr);
+
+    size_t size() const;
+
+    // Write the result of every expression against `document` to
+    // `output`; false if any expression failed
+    bool evaluate(const Document& document, Output& output, const EvaluateOptions& options = EvaluateOptions()) const;
+
+    // Evaluate the expressions against each newline-delimited JSON record
+    // read from `fd` until its end; records that fail are reported with
+    // their line number and the rest still evaluated. False if any record
+    // failed; throws if `fd` cannot be read.
+    bool evaluateRecords(int fd, Output& output, const EvaluateOptions& options = EvaluateOptions()) const;
+
+private:
+    friend class Document;
+    explicit QuerySet(std::shared_ptr<const CompiledQuerySet> compiled);
+
+    std::shared_ptr<const CompiledQuerySet> compiled;
+};
+
+// Deepest nesting of arrays and objects accepted by JSON parsing started
+// afterwards, 100000 by default, as with --max-depth. Set it before any
+// other thread uses the library. Expressions have a limit of their own,
+// fixed at 1000 levels, since they are compiled by recursion; compiling a
+// deeper one fails with "Expression nested too deeply".
+JSON_EVAL_API void setMaxDepth(size_t depth);
+
+} // namespace json_eval
+
+#endif // JSON_EVAL_H
@@ -0,0 +1,4812 @@
+// Internals of the JSON expression evaluator: the arena, key table and
+// value representation, the JSON parser and writer, the document cache,
+// the expression parser, optimizer, compiler and virtual machine, and the
+// evaluation of expression sets against documents and records built on
+// them.
+//
+// Everything is defined in this header, inline, so any number of
+// translation units may include it, in programs linked with the library or
+// not. json_eval.cpp implements the library interface of json_eval.h on
+// top of it. Nothing here is a stable interface; applications should use
+// json_eval.h.
+
+#ifndef JSON_EVAL_INTERNAL_H
+#define JSON_EVAL_INTERNAL_H
+
+#include <ostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cctype>
+#include <cstddef>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <locale.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Bump allocator that owns a group of objects with a common lifetime (a
+// parsed document, an expression AST). Allocation is a pointer increment
+// inside a large chunk; everything is released at once when the arena is
+// destroyed. Objects with non-trivial destructors created through make()
+// are destroyed in reverse order of creation on release.
+class Arena {
+public:
+    explicit Arena(size_t chunkSize = 64 * 1024)
+        : cursor(nullptr), limit(nullptr), chunks(nullptr), finalizers(nullptr), nextChunkSize(chunkSize),
+          chunkCount(0), chunkBytes(0) {}
+
+    ~Arena() { release(); }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(uintptr_t)(align - 1);
+        if (!cursor || aligned + size > reinterpret_cast<uintptr_t>(limit)) {
+            addChunk(size + align);
+            aligned = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~(uintptr_t)(align - 1);
+        }
+        cursor = reinterpret_cast<char*>(aligned + size);
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    template <typename T>
+    T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    // Construct an object in the arena; its destructor runs on release
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        T* object = makeUnfinalized<T>(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            Finalizer* finalizer = static_cast<Finalizer*>(allocate(sizeof(Finalizer), alignof(Finalizer)));
+            finalizer->destroy = &destroy<T>;
+            finalizer->object = object;
+            finalizer->next = finalizers;
+            finalizers = finalizer;
+        }
+        return object;
+    }
+
+    // Construct an object whose destructor never needs to run, because
+    // all the memory it owns was itself allocated from this arena
+    template <typename T, typename... Args>
+    T* makeUnfinalized(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Destroy all objects and free all chunks; the arena can be reused
+    void release() {
+        while (finalizers) {
+            finalizers->destroy(finalizers->object);
+            finalizers = finalizers->next;
+        }
+        while (chunks) {
+            Chunk* next = chunks->next;
+            ::operator delete(chunks);
+            chunks = next;
+        }
+        cursor = limit = nullptr;
+    }
+
+    // Destroy all objects but keep the current chunk for reuse, so an
+    // arena reset once per record stops allocating after the first few
+    void reset() {
+        while (finalizers) {
+            finalizers->destroy(finalizers->object);
+            finalizers = finalizers->next;
+        }
+        if (!chunks) return;
+        while (chunks->next) {
+            Chunk* next = chunks->next->next;
+            ::operator delete(chunks->next);
+            chunks->next = next;
+        }
+        cursor = reinterpret_cast<char*>(chunks + 1);
+    }
+
+    // Chunks and bytes taken from the heap over the arena's lifetime
+    size_t chunksAllocated() const { return chunkCount; }
+    size_t bytesAllocated() const { return chunkBytes; }
+
+private:
+    struct Chunk {
+        Chunk* next;
+    };
+
+    struct Finalizer {
+        void (*destroy)(void*);
+        void* object;
+        Finalizer* next;
+    };
+
+    static const size_t maxChunkSize = 4 * 1024 * 1024;
+
+    char* cursor;
+    char* limit;
+    Chunk* chunks;
+    Finalizer* finalizers;
+    size_t nextChunkSize;
+    size_t chunkCount;
+    size_t chunkBytes;
+
+    template <typename T>
+    static void destroy(void* object) {
+        static_cast<T*>(object)->~T();
+    }
+
+    void addChunk(size_t minSize) {
+        size_t size = std::max(nextChunkSize, minSize + sizeof(Chunk));
+        Chunk* chunk = static_cast<Chunk*>(::operator new(size));
+        chunk->next = chunks;
+        chunks = chunk;
+        cursor = reinterpret_cast<char*>(chunk + 1);
+        limit = reinterpret_cast<char*>(chunk) + size;
+        nextChunkSize = std::min(nextChunkSize * 2, static_cast<size_t>(maxChunkSize));
+        chunkCount++;
+        chunkBytes += size;
+    }
+};
+
+// Standard allocator adapter over an Arena, for containers whose nodes
+// should live in the arena. Deallocation is a no-op.
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    Arena* arena;
+
+    explicit ArenaAllocator(Arena& arena) : arena(&arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) { return arena->allocateArray<T>(count); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+// Non-owning view of a run of characters
+struct StringRef {
+    const char* data;
+    size_t length;
+
+    StringRef() : data(""), length(0) {}
+    StringRef(const char* data, size_t length) : data(data), length(length) {}
+    StringRef(const std::string& str) : data(str.data()), length(str.length()) {}
+
+    std::string str() const { return std::string(data, length); }
+
+    bool operator==(const StringRef& other) const {
+        return length == other.length && std::memcmp(data, other.data, length) == 0;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const StringRef& str) {
+    return out.write(str.data, static_cast<std::streamsize>(str.length));
+}
+
+// FNV-1a hash over the characters of a StringRef
+struct StringRefHash {
+    size_t operator()(const StringRef& str) const {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < str.length; ++i) {
+            hash ^= static_cast<unsigned char>(str.data[i]);
+            hash *= 1099511628211ull;
+        }
+        return static_cast<size_t>(hash);
+    }
+};
+
+// Number of an interned object key
+using KeyId = uint32_t;
+
+// Process-wide table of object keys. Every distinct key is stored once and
+// numbered, so parsed objects and compiled expressions can refer to keys by
+// number and a member lookup compares integers instead of hashing text.
+// Lookups take no lock: ids live in an open-addressing index that is only
+// ever added to, and each slot is published after the key it refers to.
+// Interning a new key takes a lock; when the index grows, the old one is
+// kept so readers still holding it stay valid. Keys are never removed:
+// memory grows with the number of distinct keys, not with the input, and
+// interning fails once maxKeys of them exist.
+class KeyTable {
+public:
+    static const KeyId noKey = std::numeric_limits<KeyId>::max();
+
+    static KeyTable& global() {
+        static KeyTable table;
+        return table;
+    }
+
+    KeyId intern(StringRef key) {
+        size_t hash = StringRefHash()(key);
+        KeyId id = lookup(key, hash);
+        if (id != noKey) return id;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        id = lookup(key, hash); // another thread may have interned it meanwhile
+        if (id != noKey) return id;
+        id = count.load(std::memory_order_relaxed);
+        if (id == maxKeys) {
+            throw std::runtime_error("Too many distinct object keys");
+        }
+
+        char* copy = static_cast<char*>(arena.allocate(key.length + 1, 1));
+        std::memcpy(copy, key.data, key.length);
+        StringRef*& block = blocks[id / blockSize];
+        if (!block) block = arena.allocateArray<StringRef>(blockSize);
+        block[id % blockSize] = StringRef(copy, key.length);
+
+        Index* index = current.load(std::memory_order_relaxed);
+        if (2 * (static_cast<size_t>(id) + 1) > index->mask + 1) index = grow(index, id);
+        place(index, hash, id);
+        count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    // Id of `key` if it has been interned, otherwise noKey (which no
+    // object contains)
+    KeyId find(StringRef key) const { return lookup(key, StringRefHash()(key)); }
+
+    StringRef name(KeyId id) const {
+        return blocks[id / blockSize][id % blockSize];
+    }
+
+    // Number of keys interned so far; their ids are 0 to size() - 1
+    KeyId size() const { return count.load(std::memory_order_acquire); }
+
+    static const KeyId maxKeys = 1u << 26;
+
+private:
+    static const size_t blockSize = 4096;
+    static const size_t maxBlocks = maxKeys / blockSize;
+
+    // Slots hold id + 1, or 0 when free; at most half of them are used
+    struct Index {
+        size_t mask;
+        std::atomic<KeyId>* slots;
+    };
+
+    std::mutex mutex;
+    Arena arena;
+    std::atomic<Index*> current;
+    StringRef* blocks[maxBlocks] = {};
+    std::atomic<KeyId> count;
+
+    KeyTable() : current(nullptr), count(0) { current.store(makeIndex(1024)); }
+
+    KeyId lookup(StringRef key, size_t hash) const {
+        const Index* index = current.load(std::memory_order_acquire);
+        for (size_t slot = hash & index->mask;; slot = (slot + 1) & index->mask) {
+            KeyId entry = index->slots[slot].load(std::memory_order_acquire);
+            if (entry == 0) return noKey;
+            if (name(entry - 1) == key) return entry - 1;
+        }
+    }
+
+    static void place(Index* index, size_t hash, KeyId id) {
+        size_t slot = hash & index->mask;
+        while (index->slots[slot].load(std::memory_order_relaxed) != 0) slot = (slot + 1) & index->mask;
+        index->slots[slot].store(id + 1, std::memory_order_release);
+    }
+
+    Index* makeIndex(size_t capacity) {
+        Index* index = arena.make<Index>();
+        index->mask = capacity - 1;
+        index->slots = arena.allocateArray<std::atomic<KeyId>>(capacity);
+        for (size_t slot = 0; slot < capacity; ++slot) new (&index->slots[slot]) std::atomic<KeyId>(0);
+        return index;
+    }
+
+    // Publishes an index of twice the capacity holding keys 0 to `keys` - 1
+    Index* grow(const Index* old, KeyId keys) {
+        Index* index = makeIndex(2 * (old->mask + 1));
+        for (KeyId id = 0; id < keys; ++id) place(index, StringRefHash()(name(id)), id);
+        current.store(index, std::memory_order_release);
+        return index;
+    }
+};
+
+// Forward declarations
+struct JSONValue;
+struct JSONArray;
+struct JSONObject;
+struct Expression;
+
+enum class JSONValueType : uint8_t { Null, Object, Array, String, Number };
+
+// Compact JSON value: a one-byte type tag, a 32-bit length and a single
+// 8-byte payload, 16 bytes in total. Numbers are stored inline; strings,
+// arrays and objects point to storage owned elsewhere (the document's
+// arena, the input buffer or a DocumentCache), so values are cheap to copy
+// and never free anything themselves. Arrays whose elements are all
+// numbers are stored packed, as a plain buffer of doubles. Arrays and
+// objects read from a cache point into its file, whose blocks hold
+// offsets and the file's key ids; `cache` says which cache resolves them,
+// so their elements and members must be read through arrayValue(),
+// findMember(), memberKey() and memberValue().
+struct JSONValue {
+    JSONValueType type = JSONValueType::Null;
+    bool packed = false;    // array elements are in numbersPtr
+    uint16_t cache = 0;     // slot of the DocumentCache holding the children, 0 if none
+    uint32_t length = 0;    // string length or array element count
+    union {
+        double numberValue;
+        const char* stringPtr;
+        const JSONValue* arrayPtr;
+        const double* numbersPtr;
+        const JSONObject* objectPtr;
+    };
+
+    // Default constructor
+    JSONValue() : numberValue(0) {}
+
+    // Constructors for each type
+    JSONValue(double num) : type(JSONValueType::Number), numberValue(num) {}
+
+    JSONValue(StringRef str)
+        : type(JSONValueType::String), length(checkedLength(str.length)), stringPtr(str.data) {}
+
+    JSONValue(const JSONValue* items, size_t count)
+        : type(JSONValueType::Array), length(checkedLength(count)), arrayPtr(items) {}
+
+    JSONValue(const JSONObject* obj) : type(JSONValueType::Object), objectPtr(obj) {}
+
+    // Array of `count` numbers stored contiguously
+    static JSONValue packedArray(const double* numbers, size_t count) {
+        JSONValue value;
+        value.type = JSONValueType::Array;
+        value.packed = true;
+        value.length = checkedLength(count);
+        value.numbersPtr = numbers;
+        return value;
+    }
+
+    // Payload accessors; callers check `type` first
+    StringRef stringValue() const { return StringRef(stringPtr, length); }
+    JSONArray arrayValue() const;
+
+    // The object's block; only its size holds for objects read from a cache
+    const JSONObject& objectValue() const { return *objectPtr; }
+
+    // Members of an object, parsed or read from a cache. findMember() sets
+    // `value` to the member named `key`, if there is one.
+    bool findMember(KeyId key, JSONValue& value) const;
+    KeyId memberKey(size_t index) const;
+    JSONValue memberValue(size_t index) const;
+
+private:
+    static uint32_t checkedLength(size_t count) {
+        if (count > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("JSON value too large");
+        }
+        return static_cast<uint32_t>(count);
+    }
+};
+
+// Element `stored` of an array read from the DocumentCache in `slot`
+inline JSONValue cachedValue(uint16_t slot, const JSONValue* stored);
+
+// View of an array's elements, which are stored contiguously either as
+// JSONValues or, for packed arrays, as doubles. Elements are handed out by
+// value, since a packed element only exists as a double and an element
+// read from a cache is resolved first.
+struct JSONArray {
+    const JSONValue* items; // nullptr when packed
+    const double* numbers;  // nullptr unless packed
+    size_t count;
+    uint16_t cache;         // JSONValue::cache of the array
+
+    struct Iterator {
+        const JSONArray* array;
+        size_t index;
+
+        JSONValue operator*() const { return (*array)[index]; }
+        Iterator& operator++() {
+            ++index;
+            return *this;
+        }
+        bool operator!=(const Iterator& other) const { return index != other.index; }
+    };
+
+    size_t size() const { return count; }
+    bool isPacked() const { return numbers != nullptr; }
+    JSONValue operator[](size_t index) const {
+        return numbers ? JSONValue(numbers[index]) : cache ? cachedValue(cache, items + index) : items[index];
+    }
+    Iterator begin() const { return Iterator{this, 0}; }
+    Iterator end() const { return Iterator{this, count}; }
+};
+
+inline JSONArray JSONValue::arrayValue() const {
+    return packed ? JSONArray{nullptr, numbersPtr, length, 0} : JSONArray{arrayPtr, nullptr, length, cache};
+}
+
+// Array position selected by an index number in an expression. Fractions
+// are truncated toward zero, so numbers[1.5] is numbers[1] and -0.5 is 0.
+// Negative indices give -1. Arrays hold at most 2^32 - 1 elements, so
+// larger indices, and NaN, give 2^32 - 1, which is out of bounds of any
+// array and still fits a CompiledStep.
+inline int64_t arrayIndex(double number) {
+    if (number <= -1) return -1;
+    if (!(number < 4294967295.0)) return 4294967295;
+    return static_cast<int64_t>(number);
+}
+
+// Position of `key` in keys[0, count), or count if it is not there. On x86
+// the scan compares four keys per step with SSE2, which every x86-64 CPU
+// has; objects are small, so there is nothing to gain from dispatching to
+// wider kernels at run time.
+inline size_t findKeyId(const KeyId* keys, size_t count, KeyId key) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi32(static_cast<int>(key));
+    for (; i + 4 <= count; i += 4) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, needle))));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        if (keys[i] == key) return i;
+    }
+    return count;
+}
+
+// Object members in document order, stored in one arena block: this
+// header, then the values, then the keys. Small objects are searched by
+// scanning the keys; larger ones also get an open-addressing index of
+// (key, position) slots so lookups stay constant-time.
+struct JSONObject {
+    // Objects with more members than this get an index
+    static const size_t linearLimit = 16;
+
+    struct IndexSlot {
+        KeyId key;
+        uint32_t position; // member position + 1, 0 if the slot is empty
+    };
+
+    uint32_t count;
+    uint32_t indexMask;     // index slot count - 1
+    const IndexSlot* index; // nullptr for small objects
+
+    size_t size() const { return count; }
+    const JSONValue* values() const { return reinterpret_cast<const JSONValue*>(this + 1); }
+    const KeyId* keys() const { return reinterpret_cast<const KeyId*>(values() + count); }
+    KeyId key(size_t i) const { return keys()[i]; }
+    const JSONValue& value(size_t i) const { return values()[i]; }
+
+    // Value of `key`, or nullptr
+    const JSONValue* find(KeyId key) const {
+        if (index) {
+            for (uint32_t slot = indexSlot(key, indexMask); index[slot].position != 0;
+                 slot = (slot + 1) & indexMask) {
+                if (index[slot].key == key) return &values()[index[slot].position - 1];
+            }
+            return nullptr;
+        }
+        size_t i = findKeyId(keys(), count, key);
+        return i < count ? &values()[i] : nullptr;
+    }
+
+    // First slot to probe for `key` (Fibonacci hashing)
+    static uint32_t indexSlot(KeyId key, uint32_t mask) {
+        return static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    }
+};
+
+// Read-only view of a file's contents. Regular files are memory-mapped so
+// the parser reads the page cache directly; anything that cannot be mapped
+// (pipes, empty files) is read into an owned buffer instead. A mapped file
+// that is truncated while mapped raises SIGBUS when the lost pages are
+// touched, so files that may change while in use are read with `map`
+// false.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path, bool map = true) : mapped(nullptr), length(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open JSON file: " + path);
+        }
+
+        struct stat info;
+        if (map && fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void* addr = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                mapped = static_cast<const char*>(addr);
+                length = static_cast<size_t>(info.st_size);
+                madvise(addr, length, MADV_SEQUENTIAL);
+            }
+        }
+
+        if (!mapped) {
+            readAll(fd, path);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (mapped) {
+            munmap(const_cast<char*>(mapped), length);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return mapped ? mapped : buffer.data(); }
+    size_t size() const { return mapped ? length : buffer.size(); }
+
+private:
+    const char* mapped;
+    size_t length;
+    std::string buffer;
+
+    void readAll(int fd, const std::string& path) {
+        char chunk[65536];
+        while (true) {
+            ssize_t count = read(fd, chunk, sizeof(chunk));
+            if (count < 0) {
+                close(fd);
+                throw std::runtime_error("Cannot read JSON file: " + path);
+            }
+            if (count == 0) break;
+            buffer.append(chunk, static_cast<size_t>(count));
+        }
+    }
+};
+
+// Reads newline-delimited records (NDJSON / JSON Lines) from a file
+// descriptor through one reusable buffer, so memory use is bounded by the
+// longest record rather than the size of the input. A record stays valid
+// until the next call to next().
+class RecordReader {
+public:
+    explicit RecordReader(int fd) : fd(fd), buffer(65536), start(0), end(0), eof(false), line(0), total(0) {}
+
+    // Fetch the next line without its terminator; false at end of input
+    bool next(StringRef& record) {
+        while (true) {
+            char* newline = static_cast<char*>(std::memchr(buffer.data() + start, '\n', end - start));
+            if (newline) {
+                size_t stop = newline - buffer.data();
+                record = trimCarriageReturn(start, stop);
+                start = stop + 1;
+                line++;
+                return true;
+            }
+            if (eof) {
+                if (start == end) return false;
+                record = trimCarriageReturn(start, end);
+                start = end;
+                line++;
+                return true;
+            }
+            fill();
+        }
+    }
+
+    // Line number of the record returned by the last call to next()
+    size_t lineNumber() const { return line; }
+
+    // Bytes read from the input so far
+    size_t bytesRead() const { return total; }
+
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t start;
+    size_t end;
+    bool eof;
+    size_t line;
+    size_t total;
+
+    StringRef trimCarriageReturn(size_t from, size_t to) const {
+        if (to > from && buffer[to - 1] == '\r') to--;
+        return StringRef(buffer.data() + from, to - from);
+    }
+
+    // Move the partial record to the front and read more after it,
+    // growing the buffer only when one record fills it
+    void fill() {
+        if (start > 0) {
+            std::memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        if (end == buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+        ssize_t count = read(fd, buffer.data() + end, buffer.size() - end);
+        if (count < 0) {
+            throw std::runtime_error("Cannot read input");
+        }
+        if (count == 0) {
+            eof = true;
+        }
+        end += static_cast<size_t>(count);
+        total += static_cast<size_t>(count);
+    }
+};
+
+// Byte-scanning kernels used by JSONParser. Each kernel has a portable
+// scalar version plus SSE2 (16 bytes per step) and AVX2 (32 bytes per
+// step) versions on x86; the widest one the CPU supports is chosen at
+// startup and can be overridden with selectScanner().
+enum class SIMDLevel { Scalar, SSE2, AVX2 };
+
+struct Scanner {
+    SIMDLevel level;
+    // First byte in [p, end) that is not JSON whitespace, or end
+    const char* (*skipWhitespace)(const char* p, const char* end);
+    // First '"' or '\\' in [p, end), or end
+    const char* (*findQuoteOrEscape)(const char* p, const char* end);
+    // First '"', '{', '}', '[' or ']' in [p, end), or end
+    const char* (*findStructural)(const char* p, const char* end);
+};
+
+inline bool isJSONWhitespace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+inline const char* skipWhitespaceScalar(const char* p, const char* end) {
+    while (p < end && isJSONWhitespace(*p)) {
+        p++;
+    }
+    return p;
+}
+
+inline const char* findQuoteOrEscapeScalar(const char* p, const char* end) {
+    while (p < end && *p != '"' && *p != '\\') {
+        p++;
+    }
+    return p;
+}
+
+inline const char* findStructuralScalar(const char* p, const char* end) {
+    while (p < end && *p != '"' && *p != '{' && *p != '}' && *p != '[' && *p != ']') {
+        p++;
+    }
+    return p;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+inline const char* skipWhitespaceSSE2(const char* p, const char* end) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriage = _mm_set1_epi8('\r');
+    const __m128i tab = _mm_set1_epi8('\t');
+    for (; end - p >= 16; p += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, newline)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(block, carriage), _mm_cmpeq_epi8(block, tab)));
+        unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(ws)) & 0xFFFFu;
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return skipWhitespaceScalar(p, end);
+}
+
+inline const char* findQuoteOrEscapeSSE2(const char* p, const char* end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for (; end - p >= 16; p += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash))));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return findQuoteOrEscapeScalar(p, end);
+}
+
+inline const char* findStructuralSSE2(const char* p, const char* end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i openBrace = _mm_set1_epi8('{');
+    const __m128i closeBrace = _mm_set1_epi8('}');
+    const __m128i openBracket = _mm_set1_epi8('[');
+    const __m128i closeBracket = _mm_set1_epi8(']');
+    for (; end - p >= 16; p += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i braces = _mm_or_si128(_mm_cmpeq_epi8(block, openBrace), _mm_cmpeq_epi8(block, closeBrace));
+        __m128i brackets = _mm_or_si128(_mm_cmpeq_epi8(block, openBracket), _mm_cmpeq_epi8(block, closeBracket));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_or_si128(braces, brackets));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return findStructuralScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+inline const char* skipWhitespaceAVX2(const char* p, const char* end) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i carriage = _mm256_set1_epi8('\r');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    for (; end - p >= 32; p += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i ws = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, space), _mm256_cmpeq_epi8(block, newline)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, carriage), _mm256_cmpeq_epi8(block, tab)));
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(ws));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return skipWhitespaceSSE2(p, end);
+}
+
+__attribute__((target("avx2")))
+inline const char* findQuoteOrEscapeAVX2(const char* p, const char* end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    for (; end - p >= 32; p += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, backslash))));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return findQuoteOrEscapeSSE2(p, end);
+}
+
+__attribute__((target("avx2")))
+inline const char* findStructuralAVX2(const char* p, const char* end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i openBrace = _mm256_set1_epi8('{');
+    const __m256i closeBrace = _mm256_set1_epi8('}');
+    const __m256i openBracket = _mm256_set1_epi8('[');
+    const __m256i closeBracket = _mm256_set1_epi8(']');
+    for (; end - p >= 32; p += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i braces = _mm256_or_si256(_mm256_cmpeq_epi8(block, openBrace), _mm256_cmpeq_epi8(block, closeBrace));
+        __m256i brackets =
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, openBracket), _mm256_cmpeq_epi8(block, closeBracket));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_or_si256(braces, brackets));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return findStructuralSSE2(p, end);
+}
+#endif
+
+// Widest SIMD level supported by the running CPU
+inline SIMDLevel detectSIMDLevel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMDLevel::AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMDLevel::SSE2;
+#endif
+    return SIMDLevel::Scalar;
+}
+
+inline Scanner makeScanner(SIMDLevel level) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (level == SIMDLevel::AVX2) {
+        return Scanner{level, &skipWhitespaceAVX2, &findQuoteOrEscapeAVX2, &findStructuralAVX2};
+    }
+    if (level == SIMDLevel::SSE2) {
+        return Scanner{level, &skipWhitespaceSSE2, &findQuoteOrEscapeSSE2, &findStructuralSSE2};
+    }
+#endif
+    return Scanner{SIMDLevel::Scalar, &skipWhitespaceScalar, &findQuoteOrEscapeScalar, &findStructuralScalar};
+}
+
+inline Scanner& activeScanner() {
+    static Scanner scanner = makeScanner(detectSIMDLevel());
+    return scanner;
+}
+
+// Force a particular kernel set (levels the CPU lacks fall back to scalar)
+inline void selectScanner(SIMDLevel level) {
+    activeScanner() = makeScanner(level <= detectSIMDLevel() ? level : SIMDLevel::Scalar);
+}
+
+// Reductions over packed number arrays, with scalar, SSE2 and AVX2
+// versions chosen per CPU like the scanning kernels. Each vector version
+// keeps two accumulators to hide the latency of the adds and compares.
+// Sums are added in a different order than a sequential loop would, so
+// they can differ from one in the last bits.
+struct Reductions {
+    SIMDLevel level;
+    double (*minimum)(const double* p, size_t count); // +inf for no numbers
+    double (*maximum)(const double* p, size_t count); // -inf for no numbers
+    double (*sum)(const double* p, size_t count);
+};
+
+inline double minimumScalar(const double* p, size_t count) {
+    double result = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < count; ++i) {
+        result = std::min(result, p[i]);
+    }
+    return result;
+}
+
+inline double maximumScalar(const double* p, size_t count) {
+    double result = -std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < count; ++i) {
+        result = std::max(result, p[i]);
+    }
+    return result;
+}
+
+inline double sumScalar(const double* p, size_t count) {
+    double result = 0;
+    for (size_t i = 0; i < count; ++i) {
+        result += p[i];
+    }
+    return result;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+inline double minimumSSE2(const double* p, size_t count) {
+    __m128d acc0 = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    __m128d acc1 = acc0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc0 = _mm_min_pd(acc0, _mm_loadu_pd(p + i));
+        acc1 = _mm_min_pd(acc1, _mm_loadu_pd(p + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_min_pd(acc0, acc1));
+    return std::min(std::min(lanes[0], lanes[1]), minimumScalar(p + i, count - i));
+}
+
+inline double maximumSSE2(const double* p, size_t count) {
+    __m128d acc0 = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    __m128d acc1 = acc0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc0 = _mm_max_pd(acc0, _mm_loadu_pd(p + i));
+        acc1 = _mm_max_pd(acc1, _mm_loadu_pd(p + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_max_pd(acc0, acc1));
+    return std::max(std::max(lanes[0], lanes[1]), maximumScalar(p + i, count - i));
+}
+
+inline double sumSSE2(const double* p, size_t count) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = acc0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(p + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(p + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + sumScalar(p + i, count - i);
+}
+
+__attribute__((target("avx2")))
+inline double minimumAVX2(const double* p, size_t count) {
+    __m256d acc0 = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    __m256d acc1 = acc0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm256_min_pd(acc0, _mm256_loadu_pd(p + i));
+        acc1 = _mm256_min_pd(acc1, _mm256_loadu_pd(p + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_min_pd(acc0, acc1));
+    double result = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+    return std::min(result, minimumSSE2(p + i, count - i));
+}
+
+__attribute__((target("avx2")))
+inline double maximumAVX2(const double* p, size_t count) {
+    __m256d acc0 = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+    __m256d acc1 = acc0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm256_max_pd(acc0, _mm256_loadu_pd(p + i));
+        acc1 = _mm256_max_pd(acc1, _mm256_loadu_pd(p + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_max_pd(acc0, acc1));
+    double result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    return std::max(result, maximumSSE2(p + i, count - i));
+}
+
+__attribute__((target("avx2")))
+inline double sumAVX2(const double* p, size_t count) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = acc0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(p + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(p + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + sumSSE2(p + i, count - i);
+}
+#endif
+
+inline Reductions makeReductions(SIMDLevel level) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (level == SIMDLevel::AVX2) {
+        return Reductions{level, &minimumAVX2, &maximumAVX2, &sumAVX2};
+    }
+    if (level == SIMDLevel::SSE2) {
+        return Reductions{level, &minimumSSE2, &maximumSSE2, &sumSSE2};
+    }
+#endif
+    return Reductions{SIMDLevel::Scalar, &minimumScalar, &maximumScalar, &sumScalar};
+}
+
+inline Reductions& activeReductions() {
+    static Reductions reductions = makeReductions(detectSIMDLevel());
+    return reductions;
+}
+
+// Force a particular reduction kernel set, as selectScanner does
+inline void selectReductions(SIMDLevel level) {
+    activeReductions() = makeReductions(level <= detectSIMDLevel() ? level : SIMDLevel::Scalar);
+}
+
+// Number parsing shared by JSONParser and Lexer. Works directly on the
+// input bytes: digits are accumulated into a 64-bit mantissa and, when
+// both the mantissa and the decimal exponent are small enough to be exact
+// doubles, a single IEEE multiply or divide yields the correctly rounded
+// result (Clinger's fast path, the first stage of fast_float). Numbers
+// outside that range (more than 19 significant digits, huge exponents)
+// fall back to strtod_l on a copy of the bytes, in the "C" locale so a
+// program that sets a locale with a decimal comma reads them the same.
+//
+// Grammar: -? digits ('.' digits)? ([eE] [+-]? digits)?
+// Returns the position after the number, or nullptr if there is none.
+inline const char* parseNumberText(const char* p, const char* end, double& out) {
+    static const locale_t classicLocale = newlocale(LC_ALL_MASK, "C", static_cast<locale_t>(0));
+    static const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const uint64_t maxExactMantissa = uint64_t(1) << 53;
+
+    const char* start = p;
+    bool negative = p < end && *p == '-';
+    if (negative) p++;
+
+    // Integer and fractional digits; only the first 19 fit the mantissa
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool truncated = false;
+    const char* digitsStart = p;
+    for (; p < end && isdigit(static_cast<unsigned char>(*p)); ++p) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+            if (mantissa != 0) digits++;
+        } else {
+            exponent++;
+            truncated = true;
+        }
+    }
+    bool hasDigits = p != digitsStart;
+    if (p < end && *p == '.') {
+        const char* fractionStart = ++p;
+        for (; p < end && isdigit(static_cast<unsigned char>(*p)); ++p) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+                if (mantissa != 0) digits++;
+                exponent--;
+            } else {
+                truncated = true;
+            }
+        }
+        hasDigits = hasDigits || p != fractionStart;
+    }
+    if (!hasDigits) {
+        return nullptr;
+    }
+
+    // Exponent; an 'e' without digits is not part of the number
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negativeExponent = false;
+        if (q < end && (*q == '+' || *q == '-')) {
+            negativeExponent = *q == '-';
+            q++;
+        }
+        if (q < end && isdigit(static_cast<unsigned char>(*q))) {
+            int explicitExponent = 0;
+            for (; q < end && isdigit(static_cast<unsigned char>(*q)); ++q) {
+                if (explicitExponent < 100000) {
+                    explicitExponent = explicitExponent * 10 + (*q - '0');
+                }
+            }
+            exponent += negativeExponent ? -explicitExponent : explicitExponent;
+            p = q;
+        }
+    }
+
+#if FLT_EVAL_METHOD == 0
+    if (!truncated && mantissa <= maxExactMantissa) {
+        double value = static_cast<double>(mantissa);
+        bool exact = true;
+        if (mantissa == 0) {
+            // Zero regardless of exponent
+        } else if (exponent < 0 && exponent >= -22) {
+            value /= powersOfTen[-exponent];
+        } else if (exponent >= 0 && exponent <= 22) {
+            value *= powersOfTen[exponent];
+        } else if (exponent > 22 && exponent <= 22 + 15) {
+            // Shift part of the exponent into the mantissa while it stays exact
+            double shifted = value * powersOfTen[exponent - 22];
+            exact = shifted <= static_cast<double>(maxExactMantissa);
+            value = shifted * powersOfTen[22];
+        } else {
+            exact = false;
+        }
+        if (exact) {
+            out = negative ? -value : value;
+            return p;
+        }
+    }
+#endif
+
+    // Slow path: strtod_l needs a terminated copy of the bytes
+    std::string copy(start, p - start);
+    out = strtod_l(copy.c_str(), nullptr, classicLocale);
+    return p;
+}
+
+// Floating-point number with a 64-bit significand and a binary exponent,
+// worth f * 2^e, as used by Grisu
+struct DiyFp {
+    uint64_t f;
+    int e;
+
+    DiyFp(uint64_t f, int e) : f(f), e(e) {}
+
+    // Exact value of a finite, positive double
+    explicit DiyFp(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        int biased = static_cast<int>((bits >> 52) & 0x7FF);
+        f = bits & ((uint64_t(1) << 52) - 1);
+        if (biased != 0) {
+            f += uint64_t(1) << 52;
+            e = biased - 1075;
+        } else {
+            e = -1074; // subnormal
+        }
+    }
+
+    DiyFp operator-(const DiyFp& other) const { return DiyFp(f - other.f, e); }
+
+    // Product rounded to the upper 64 bits
+    DiyFp operator*(const DiyFp& other) const {
+        const uint64_t mask = 0xFFFFFFFF;
+        uint64_t a = f >> 32, b = f & mask, c = other.f >> 32, d = other.f & mask;
+        uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+        uint64_t middle = (bd >> 32) + (ad & mask) + (bc & mask) + (uint64_t(1) << 31);
+        return DiyFp(ac + (ad >> 32) + (bc >> 32) + (middle >> 32), e + other.e + 64);
+    }
+
+    DiyFp normalized() const {
+        int shift = __builtin_clzll(f);
+        return DiyFp(f << shift, e - shift);
+    }
+};
+
+// Shortest digits for a finite, positive double with Grisu2 (Loitsch,
+// "Printing floating-point numbers quickly and accurately with integers").
+// Writes up to 17 digits to `digits` and returns their count; the value
+// is digits * 10^exponent. The result always reads back as `value` and is
+// the shortest such string for all but a tiny fraction of inputs.
+inline int grisu2(double value, char* digits, int& exponent) {
+    // 10^k for k = -348, -340, ..., 340 as normalized DiyFps
+    static const uint64_t cachedSignificands[] = {
+        0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull,
+        0xcf42894a5dce35eaull, 0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull,
+        0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full, 0xbe5691ef416bd60cull,
+        0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+        0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull,
+        0xc21094364dfb5637ull, 0x9096ea6f3848984full, 0xd77485cb25823ac7ull,
+        0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull, 0xb23867fb2a35b28eull,
+        0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+        0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull,
+        0xb5b5ada8aaff80b8ull, 0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull,
+        0x964e858c91ba2655ull, 0xdff9772470297ebdull, 0xa6dfbd9fb8e5b88full,
+        0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+        0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull,
+        0xaa242499697392d3ull, 0xfd87b5f28300ca0eull, 0xbce5086492111aebull,
+        0x8cbccc096f5088ccull, 0xd1b71758e219652cull, 0x9c40000000000000ull,
+        0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+        0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull,
+        0x9f4f2726179a2245ull, 0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull,
+        0x83c7088e1aab65dbull, 0xc45d1df942711d9aull, 0x924d692ca61be758ull,
+        0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+        0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull,
+        0x952ab45cfa97a0b3ull, 0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull,
+        0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull, 0x88fcf317f22241e2ull,
+        0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+        0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull,
+        0x8bab8eefb6409c1aull, 0xd01fef10a657842cull, 0x9b10a4e5e9913129ull,
+        0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull, 0x80444b5e7aa7cf85ull,
+        0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+        0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull,
+    };
+    static const int16_t cachedExponents[] = {
+        -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+        -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+        -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+        -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+        56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+        375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+        694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+        1013, 1039, 1066,
+    };
+    static const uint64_t powersOfTen[] = {
+        1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+        1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+        100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+        1000000000000000000ull, 10000000000000000000ull};
+
+    // The value and the midpoints to its neighbours, with a common exponent
+    const DiyFp v(value);
+    DiyFp upper = DiyFp((v.f << 1) + 1, v.e - 1).normalized();
+    DiyFp lower = v.f == (uint64_t(1) << 52) ? DiyFp((v.f << 2) - 1, v.e - 2) : DiyFp((v.f << 1) - 1, v.e - 1);
+    lower = DiyFp(lower.f << (lower.e - upper.e), upper.e);
+
+    // Scale by a cached power of ten so the exponent lands in [-60, -32]
+    double estimate = (-61 - upper.e) * 0.30102999566398114 + 347;
+    int k = static_cast<int>(estimate);
+    if (estimate - k > 0) k++;
+    int index = (k >> 3) + 1;
+    exponent = -(-348 + index * 8);
+    const DiyFp power(cachedSignificands[index], cachedExponents[index]);
+    const DiyFp scaled = v.normalized() * power;
+    DiyFp high = upper * power;
+    DiyFp low = lower * power;
+    low.f++;
+    high.f--;
+
+    // Generate digits of `high` until what is left fits within the
+    // rounding interval
+    uint64_t delta = high.f - low.f;
+    const DiyFp one(uint64_t(1) << -high.e, high.e);
+    const uint64_t distance = (high - scaled).f;
+    uint32_t integral = static_cast<uint32_t>(high.f >> -one.e);
+    uint64_t fraction = high.f & (one.f - 1);
+    int count = 0;
+    int kappa = 10;
+    while (kappa > 0 && integral < powersOfTen[kappa - 1]) {
+        kappa--;
+    }
+
+    uint64_t rest;
+    uint64_t unit;
+    uint64_t target;
+    while (true) {
+        if (kappa > 0) {
+            uint32_t digit = static_cast<uint32_t>(integral / powersOfTen[kappa - 1]);
+            integral %= powersOfTen[kappa - 1];
+            if (digit || count) digits[count++] = static_cast<char>('0' + digit);
+            kappa--;
+            rest = (static_cast<uint64_t>(integral) << -one.e) + fraction;
+            if (rest <= delta) {
+                unit = powersOfTen[kappa] << -one.e;
+                target = distance;
+                break;
+            }
+        } else {
+            fraction *= 10;
+            delta *= 10;
+            char digit = static_cast<char>(fraction >> -one.e);
+            if (digit || count) digits[count++] = static_cast<char>('0' + digit);
+            fraction &= one.f - 1;
+            kappa--;
+            if (fraction < delta) {
+                rest = fraction;
+                unit = one.f;
+                target = distance * (-kappa < 20 ? powersOfTen[-kappa] : 0);
+                break;
+            }
+        }
+    }
+    exponent += kappa;
+
+    // Move the last digit towards the value while that stays in range
+    while (rest < target && delta - rest >= unit && (rest + unit < target || target - rest > rest + unit - target)) {
+        digits[count - 1]--;
+        rest += unit;
+    }
+    return count;
+}
+
+// Number formatting, the inverse of parseNumberText: writes the shortest
+// decimal that reads back as exactly `value` (rarely one digit more, see
+// grisu2) into `out`, which needs room for 32 characters, and returns the
+// end of the text. Numbers with a few
+// decimal places (counts, prices, most measurements) take Clinger's fast
+// path backwards: the first scale 10^k at which value * 10^k rounds to an
+// integer m below 2^53 with m / 10^k == value gives the digits, and since
+// m and 10^k are exact doubles that division is correctly rounded, so the
+// check is exact. Other numbers go through grisu2. The digits are laid
+// out like JavaScript's Number.prototype.toString: plain decimals from
+// 1e-6 up to 1e21, exponent notation outside. JSON has no infinity or NaN,
+// so those are written as null.
+inline char* formatNumberText(double value, char* out) {
+    static const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const double maxExactMantissa = static_cast<double>(uint64_t(1) << 53);
+
+    if (!std::isfinite(value)) {
+        std::memcpy(out, "null", 4);
+        return out + 4;
+    }
+    if (value == 0) {
+        *out = '0';
+        return out + 1;
+    }
+    if (value < 0) {
+        *out++ = '-';
+        value = -value;
+    }
+
+    // Significant digits, and the position of the decimal point relative
+    // to the first of them: the value is 0.digits * 10^point
+    char digits[32];
+    int count = 0;
+    int point = 0;
+    bool found = false;
+    for (int k = 0; k <= 22 && value * powersOfTen[k] < maxExactMantissa; ++k) {
+        double scaled = std::floor(value * powersOfTen[k] + 0.5);
+        if (scaled / powersOfTen[k] == value) {
+            uint64_t mantissa = static_cast<uint64_t>(scaled);
+            char reversed[20];
+            int length = 0;
+            for (; mantissa > 0; mantissa /= 10) {
+                reversed[length++] = static_cast<char>('0' + mantissa % 10);
+            }
+            for (int i = length - 1; i >= 0; --i) {
+                digits[count++] = reversed[i];
+            }
+            point = length - k;
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        count = grisu2(value, digits, point);
+        point += count;
+    }
+    while (count > 1 && digits[count - 1] == '0') {
+        count--;
+    }
+
+    if (count <= point && point <= 21) {
+        std::memcpy(out, digits, count);
+        out += count;
+        for (int i = count; i < point; ++i) *out++ = '0';
+    } else if (0 < point && point <= 21) {
+        std::memcpy(out, digits, point);
+        out += point;
+        *out++ = '.';
+        std::memcpy(out, digits + point, count - point);
+        out += count - point;
+    } else if (-6 < point && point <= 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = point; i < 0; ++i) *out++ = '0';
+        std::memcpy(out, digits, count);
+        out += count;
+    } else {
+        *out++ = digits[0];
+        if (count > 1) {
+            *out++ = '.';
+            std::memcpy(out, digits + 1, count - 1);
+            out += count - 1;
+        }
+        out += std::sprintf(out, "e%+d", point - 1);
+    }
+    return out;
+}
+
+// The parts of a document an expression can reach. Each node stands for
+// one value; `whole` means the value itself is used (printed, passed to a
+// function, used in arithmetic) and must be built completely, otherwise
+// only the listed members and elements are needed. Children are held by
+// pointer, which keeps their addresses stable as siblings are added.
+struct AccessTree {
+    bool whole = false;
+    std::vector<std::pair<std::string, std::unique_ptr<AccessTree>>> members;
+    std::vector<std::pair<size_t, std::unique_ptr<AccessTree>>> elements;
+
+    // Child nodes, created on first use
+    AccessTree& member(const std::string& key) {
+        for (auto& entry : members) {
+            if (entry.first == key) return *entry.second;
+        }
+        members.emplace_back(key, std::unique_ptr<AccessTree>(new AccessTree()));
+        return *members.back().second;
+    }
+
+    AccessTree& element(size_t index) {
+        for (auto& entry : elements) {
+            if (entry.first == index) return *entry.second;
+        }
+        elements.emplace_back(index, std::unique_ptr<AccessTree>(new AccessTree()));
+        return *elements.back().second;
+    }
+
+    const AccessTree* findMember(StringRef key) const {
+        for (const auto& entry : members) {
+            if (StringRef(entry.first) == key) return entry.second.get();
+        }
+        return nullptr;
+    }
+
+    const AccessTree* findElement(size_t index) const {
+        for (const auto& entry : elements) {
+            if (entry.first == index) return entry.second.get();
+        }
+        return nullptr;
+    }
+};
+
+// Instrumentation for --stats. JSONParser, VirtualMachine and the record
+// evaluator take an optional Stats and count into it through STATS_HOOK,
+// which costs one predictable branch when no Stats is attached. Building
+// with -DJSON_EVAL_STATS=0 removes the hooks, phase laps included.
+#ifndef JSON_EVAL_STATS
+#define JSON_EVAL_STATS 1
+#endif
+
+#if JSON_EVAL_STATS
+#define STATS_HOOK(stats, statement)   \
+    do {                               \
+        if (stats) (stats)->statement; \
+    } while (0)
+#else
+#define STATS_HOOK(stats, statement) \
+    do {                             \
+    } while (0)
+#endif
+
+// Phases are timed as laps: each call to lap() charges the time since the
+// previous one to a phase, so one clock read separates two phases and the
+// phases add up to the whole run. Reading the CPU clock costs a system
+// call, so for records, whose phases are a few microseconds each, only
+// wall time is kept per phase.
+struct Stats {
+    enum Phase { Read, Parse, Expressions, Evaluate, Output, phaseCount };
+
+    struct Time {
+        double wall = 0; // seconds
+        double cpu = 0;  // seconds of process CPU time
+    };
+
+    Time phases[phaseCount];
+    bool cpuPerPhase = true;
+    uint64_t bytesRead = 0;
+    uint64_t records = 0;
+    uint64_t nodes[5] = {};      // values built, by JSONValueType
+    uint64_t skippedValues = 0;  // subtrees passed over by lazy parsing
+    uint64_t programsRun = 0;
+    uint64_t instructions = 0;   // instructions of the programs run, less skipped ones
+    uint64_t arenaChunks = 0;    // heap allocations made by arenas
+    uint64_t arenaBytes = 0;
+
+    Stats() : started(std::chrono::steady_clock::now()), lastWall(started), lastCpu(cpuSeconds()) {}
+
+    void lap(Phase phase) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        phases[phase].wall += std::chrono::duration<double>(now - lastWall).count();
+        lastWall = now;
+        if (cpuPerPhase) {
+            double cpu = cpuSeconds();
+            phases[phase].cpu += cpu - lastCpu;
+            lastCpu = cpu;
+        }
+    }
+
+    void countNode(JSONValueType type) { nodes[static_cast<size_t>(type)]++; }
+
+    void countArena(const Arena& arena) {
+        arenaChunks += arena.chunksAllocated();
+        arenaBytes += arena.bytesAllocated();
+    }
+
+    // One JSON object, without a newline, with the totals for the run so
+    // far and the process's peak resident memory
+    void write(std::ostream& out) const {
+        static const char* const phaseNames[] = {"read", "parse", "expressions", "evaluate", "output"};
+        static const char* const typeNames[] = {"null", "object", "array", "string", "number"};
+        out << "{\"phases\": {";
+        for (size_t i = 0; i < phaseCount; ++i) {
+            out << (i > 0 ? ", \"" : "\"") << phaseNames[i] << "\": ";
+            writeTime(out, phases[i].wall, cpuPerPhase ? phases[i].cpu : -1);
+        }
+        out << "}, \"total\": ";
+        writeTime(out, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count(),
+                  cpuSeconds());
+        out << ", \"bytes_read\": " << bytesRead << ", \"records\": " << records << ", \"nodes\": {";
+        for (size_t i = 0; i < 5; ++i) {
+            out << (i > 0 ? ", \"" : "\"") << typeNames[i] << "\": " << nodes[i];
+        }
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        out << "}, \"skipped_values\": " << skippedValues << ", \"programs_run\": " << programsRun
+            << ", \"instructions\": " << instructions << ", \"arena_chunks\": " << arenaChunks
+            << ", \"arena_bytes\": " << arenaBytes << ", \"peak_rss_kb\": " << usage.ru_maxrss << "}";
+    }
+
+private:
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point lastWall;
+    double lastCpu;
+
+    static double cpuSeconds() {
+        timespec now;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+        return now.tv_sec + now.tv_nsec * 1e-9;
+    }
+
+    // {"wall_ms": w, "cpu_ms": c}, without CPU time if it is negative
+    static void writeTime(std::ostream& out, double wall, double cpu) {
+        out << "{\"wall_ms\": " << milliseconds(wall);
+        if (cpu >= 0) {
+            out << ", \"cpu_ms\": " << milliseconds(cpu);
+        }
+        out << "}";
+    }
+
+    // `seconds` in milliseconds to three decimals, formatted from whole
+    // microseconds so the locale's decimal separator cannot get in
+    static std::string milliseconds(double seconds) {
+        long long micros = std::llround(seconds * 1e6);
+        char text[32];
+        std::snprintf(text, sizeof(text), "%lld.%03lld", micros / 1000, micros % 1000);
+        return text;
+    }
+};
+
+// Deepest nesting of arrays and objects a JSONParser accepts. Parsers keep
+// their own stack instead of recursing, so this bounds memory rather than
+// protecting the native stack. Parsers read it when they are created.
+inline size_t& maxNestingDepth() {
+    static size_t depth = 100000;
+    return depth;
+}
+
+// JSON Parser
+class JSONParser {
+public:
+    // The parser reads the buffer in place; string values without escapes
+    // borrow from it, so it must outlive the parsed document. Everything
+    // else the document needs is allocated from `arena`. Values built
+    // are counted into `stats` if given.
+    JSONParser(const char* text, size_t length, Arena& arena, Stats* stats = nullptr)
+        : text(text), length(length), pos(0), arena(arena), scanner(activeScanner()), stats(stats),
+          maxDepth(maxNestingDepth()) {
+        frames.reserve(stackReserve);
+        valueStack.reserve(stackReserve);
+        memberStack.reserve(stackReserve);
+    }
+
+    JSONParser(const std::string& text, Arena& arena, Stats* stats = nullptr)
+        : JSONParser(text.data(), text.length(), arena, stats) {}
+
+    // Point the parser at a new buffer, keeping its scratch space
+    void reset(const char* newText, size_t newLength) {
+        text = newText;
+        length = newLength;
+        pos = 0;
+        frames.clear();
+        valueStack.clear();
+        memberStack.clear();
+    }
+
+    JSONValue parse() {
+        // Parse the JSON value
+        skipWhitespace();
+        JSONValue result = parseValue();
+        skipWhitespace();
+
+        // Check for extra data
+        if (pos != length) {
+            throw std::runtime_error("Invalid JSON: Extra data after parsing");
+        }
+
+
+        return result;
+    }
+
+    // Lazy parse: build only the values `access` reaches and skip every
+    // other subtree by bracket matching, without validating it. Array
+    // elements that are not needed become null placeholders so indices
+    // and sizes stay correct. Members that are not needed are skipped up
+    // to the end of every object, since a later duplicate of a needed key
+    // replaces the earlier value as in a full parse.
+    JSONValue parse(const AccessTree& access) {
+        skipWhitespace();
+        return parsePruned(access, true);
+    }
+
+private:
+    const char* text;
+    size_t length;
+    size_t pos;
+    Arena& arena;
+    const Scanner scanner;
+    Stats* stats;
+
+    // Containers currently being parsed, innermost last; `key` is the key
+    // of the member being parsed and `base` where the container's children
+    // start on valueStack or memberStack
+    struct Frame {
+        bool isObject;
+        KeyId key;
+        size_t base;
+    };
+    std::vector<Frame> frames;
+    size_t maxDepth;
+
+    // Elements and members of the containers currently being parsed. A
+    // container's children sit on top of the stack until it is closed,
+    // then move into one contiguous arena block. Each child is copied
+    // once, so parsing is linear in the document size at any depth.
+    static const size_t stackReserve = 256;
+    std::vector<JSONValue> valueStack;
+    std::vector<std::pair<KeyId, JSONValue>> memberStack;
+
+    // Direct-mapped cache in front of the KeyTable: documents repeat the
+    // same few keys, so nearly every key resolves here without the lock
+    struct CachedKey {
+        StringRef name;
+        KeyId id = KeyTable::noKey;
+    };
+    static const size_t keyCacheSize = 512;
+    CachedKey keyCache[keyCacheSize];
+
+    KeyId internKey(StringRef key) {
+        CachedKey& entry = keyCache[StringRefHash()(key) & (keyCacheSize - 1)];
+        if (entry.id == KeyTable::noKey || !(entry.name == key)) {
+            entry.id = KeyTable::global().intern(key);
+            entry.name = KeyTable::global().name(entry.id);
+        }
+        return entry.id;
+    }
+
+    void skipWhitespace() {
+        // Most gaps are empty or a single space; only call into the
+        // kernel for longer runs such as indentation
+        if (pos < length && isJSONWhitespace(text[pos])) {
+            pos++;
+            if (pos < length && isJSONWhitespace(text[pos])) {
+                pos = scanner.skipWhitespace(text + pos, text + length) - text;
+            }
+        }
+    }
+
+    char peek() {
+        if (pos < length) {
+            return text[pos];
+        }
+        return '\0';
+    }
+
+    char get() {
+        if (pos < length) {
+            return text[pos++];
+        }
+        return '\0';
+    }
+
+    // Parse one value of any depth. Containers are tracked on `frames`
+    // rather than by recursion, so nesting is limited only by maxDepth.
+    // Containers opened by an enclosing call stay below `bottom`.
+    JSONValue parseValue() {
+        size_t bottom = frames.size();
+        JSONValue value;
+        while (true) {
+            // Parse a scalar or an empty container, or open a container
+            // and go on with its first child
+            skipWhitespace();
+            char c = peek();
+            if (c == '{' || c == '[') {
+                bool isObject = c == '{';
+                get();
+                skipWhitespace();
+                if (peek() == (isObject ? '}' : ']')) {
+                    get();
+                    value = isObject ? JSONValue(makeObject(memberStack.size())) : JSONValue(nullptr, 0);
+                } else {
+                    if (frames.size() >= maxDepth) {
+                        throw std::runtime_error("Nesting deeper than " + std::to_string(maxDepth) + " levels");
+                    }
+                    size_t base = isObject ? memberStack.size() : valueStack.size();
+                    frames.push_back(Frame{isObject, KeyTable::noKey, base});
+                    if (isObject) frames.back().key = parseMemberKey();
+                    continue;
+                }
+            } else if (c == '"') {
+                value = parseString();
+            } else if (isdigit(c) || c == '-') {
+                value = parseNumber();
+            } else {
+                // Check for unexpected character
+                throw std::runtime_error(std::string("Unexpected character in JSON: ") + c);
+            }
+            STATS_HOOK(stats, countNode(value.type));
+
+            // Add the value to its container, closing every container it
+            // completes, until one continues with another child
+            while (true) {
+                if (frames.size() == bottom) return value;
+                Frame& frame = frames.back();
+                if (frame.isObject) {
+                    memberStack.emplace_back(frame.key, value);
+                } else {
+                    valueStack.push_back(value);
+                }
+                skipWhitespace();
+                c = get();
+                if (c == ',') {
+                    if (frame.isObject) frame.key = parseMemberKey();
+                    break;
+                }
+                if (c != (frame.isObject ? '}' : ']')) {
+                    throw std::runtime_error(frame.isObject ? "Expected ',' in object" : "Expected ',' in array");
+                }
+                value = frame.isObject ? JSONValue(makeObject(frame.base)) : makeArray(frame.base);
+                frames.pop_back();
+                STATS_HOOK(stats, countNode(value.type));
+            }
+        }
+    }
+
+    // The key of an object member and its ':', leaving the parser at the value
+    KeyId parseMemberKey() {
+        skipWhitespace();
+        StringRef key = parseString().stringValue();
+        skipWhitespace();
+        if (get() != ':') throw std::runtime_error("Expected ':' in object");
+        return internKey(key);
+    }
+
+    JSONValue parsePruned(const AccessTree& access, bool topLevel = false) {
+        if (access.whole) return parseValue();
+
+        skipWhitespace();
+        char c = peek();
+        if (c != '{' && c != '[') return parseValue();
+        JSONValue value = c == '{' ? parsePrunedObject(access, topLevel) : parsePrunedArray(access);
+        STATS_HOOK(stats, countNode(value.type));
+        return value;
+    }
+
+    JSONValue parsePrunedObject(const AccessTree& access, bool topLevel) {
+        size_t base = memberStack.size();
+        if (topLevel && access.members.empty()) {
+            return JSONValue(makeObject(base));
+        }
+
+        // Consume '{'
+        get();
+        skipWhitespace();
+        if (peek() == '}') {
+            get();
+            return JSONValue(makeObject(base));
+        }
+
+        while (true) {
+            skipWhitespace();
+            if (peek() != '"') throw std::runtime_error("Expected string key in object");
+            StringRef key = parseString().stringValue();
+            skipWhitespace();
+            if (get() != ':') throw std::runtime_error("Expected ':' in object");
+
+            const AccessTree* child = access.findMember(key);
+            if (child) {
+                KeyId id = internKey(key);
+                memberStack.emplace_back(id, parsePruned(*child));
+            } else {
+                skipValue();
+            }
+            skipWhitespace();
+            char c = get();
+            if (c == '}') break;
+            if (c != ',') throw std::runtime_error("Expected ',' in object");
+        }
+
+        return JSONValue(makeObject(base));
+    }
+
+    JSONValue parsePrunedArray(const AccessTree& access) {
+        size_t base = valueStack.size();
+
+        // Consume '['
+        get();
+        skipWhitespace();
+        if (peek() == ']') {
+            get();
+            return JSONValue(nullptr, 0);
+        }
+
+        while (true) {
+            const AccessTree* child = access.findElement(valueStack.size() - base);
+            if (child) {
+                valueStack.push_back(parsePruned(*child));
+            } else {
+                skipValue();
+                valueStack.push_back(JSONValue());
+                STATS_HOOK(stats, countNode(JSONValueType::Null));
+            }
+            skipWhitespace();
+            char c = get();
+            if (c == ']') break;
+            if (c != ',') throw std::runtime_error("Expected ',' in array");
+        }
+
+        return makeArray(base);
+    }
+
+    // Move the elements above `base` on the value stack into one
+    // contiguous block, packed as doubles if they are all numbers
+    JSONValue makeArray(size_t base) {
+        size_t count = valueStack.size() - base;
+        bool allNumbers = true;
+        for (size_t i = base; i < valueStack.size() && allNumbers; ++i) {
+            allNumbers = valueStack[i].type == JSONValueType::Number;
+        }
+
+        JSONValue array;
+        if (allNumbers) {
+            double* numbers = arena.allocateArray<double>(count);
+            for (size_t i = 0; i < count; ++i) {
+                numbers[i] = valueStack[base + i].numberValue;
+            }
+            array = JSONValue::packedArray(numbers, count);
+        } else {
+            JSONValue* items = arena.allocateArray<JSONValue>(count);
+            std::copy(valueStack.begin() + base, valueStack.end(), items);
+            array = JSONValue(items, count);
+        }
+        valueStack.resize(base);
+        return array;
+    }
+
+    // Skip one value without building it. Containers are skipped by
+    // bracket matching over the structural characters, stepping over
+    // string bodies so brackets inside strings are ignored.
+    void skipValue() {
+        STATS_HOOK(stats, skippedValues++);
+        skipWhitespace();
+        const char* end = text + length;
+        const char* p = text + pos;
+        if (p >= end) throw std::runtime_error("Unexpected end of JSON");
+
+        if (*p == '"') {
+            pos = skipStringBody(p + 1, end) - text;
+        } else if (*p == '{' || *p == '[') {
+            size_t depth = 1;
+            p++;
+            while (depth > 0) {
+                p = scanner.findStructural(p, end);
+                if (p >= end) throw std::runtime_error("Unterminated array or object");
+                if (*p == '"') {
+                    p = skipStringBody(p + 1, end);
+                } else {
+                    depth += (*p == '{' || *p == '[') ? 1 : -1;
+                    p++;
+                }
+            }
+            pos = p - text;
+        } else {
+            // Number or other scalar: runs until the next delimiter
+            const char* start = p;
+            while (p < end && *p != ',' && *p != '}' && *p != ']' && !isJSONWhitespace(*p)) {
+                p++;
+            }
+            if (p == start) throw std::runtime_error(std::string("Unexpected character in JSON: ") + *p);
+            pos = p - text;
+        }
+    }
+
+    // Position after the closing quote of a string whose body starts at p
+    const char* skipStringBody(const char* p, const char* end) {
+        while (true) {
+            p = scanner.findQuoteOrEscape(p, end);
+            if (p >= end) throw std::runtime_error("Unterminated string");
+            if (*p == '"') return p + 1;
+            p += 2; // skip the escaped character
+        }
+    }
+
+    // Build an object from the members above `base` on the member stack.
+    // A later duplicate of a key overwrites the earlier value but keeps
+    // its position.
+    const JSONObject* makeObject(size_t base) {
+        std::pair<KeyId, JSONValue>* members = memberStack.data() + base;
+        size_t total = memberStack.size() - base;
+
+        // Large objects get their index first, which also finds duplicates
+        JSONObject::IndexSlot* index = nullptr;
+        uint32_t indexMask = 0;
+        if (total > JSONObject::linearLimit) {
+            size_t slots = 1;
+            while (slots < total * 2) slots <<= 1;
+            index = arena.allocateArray<JSONObject::IndexSlot>(slots);
+            std::memset(index, 0, slots * sizeof(JSONObject::IndexSlot));
+            indexMask = static_cast<uint32_t>(slots - 1);
+        }
+
+        // Compact the members in place, dropping duplicates
+        size_t count = 0;
+        for (size_t i = 0; i < total; ++i) {
+            KeyId key = members[i].first;
+            size_t existing = count;
+            if (index) {
+                uint32_t slot = JSONObject::indexSlot(key, indexMask);
+                for (; index[slot].position != 0; slot = (slot + 1) & indexMask) {
+                    if (index[slot].key == key) {
+                        existing = index[slot].position - 1;
+                        break;
+                    }
+                }
+                if (existing == count) index[slot] = JSONObject::IndexSlot{key, static_cast<uint32_t>(count + 1)};
+            } else {
+                for (size_t j = 0; j < count; ++j) {
+                    if (members[j].first == key) {
+                        existing = j;
+                        break;
+                    }
+                }
+            }
+            if (existing < count) {
+                members[existing].second = members[i].second;
+            } else {
+                members[count++] = members[i];
+            }
+        }
+
+        void* block = arena.allocate(sizeof(JSONObject) + count * (sizeof(JSONValue) + sizeof(KeyId)),
+                                     alignof(JSONValue));
+        JSONObject* obj = new (block) JSONObject{static_cast<uint32_t>(count), indexMask, index};
+        JSONValue* values = const_cast<JSONValue*>(obj->values());
+        KeyId* keys = const_cast<KeyId*>(obj->keys());
+        for (size_t i = 0; i < count; ++i) {
+            keys[i] = members[i].first;
+            values[i] = members[i].second;
+        }
+        memberStack.resize(base);
+        return obj;
+    }
+
+    JSONValue parseString() {
+        // Consume '"'
+        get();
+
+        // Strings without escapes are borrowed straight from the input
+        const char* end = text + length;
+        const char* start = text + pos;
+        const char* special = scanner.findQuoteOrEscape(start, end);
+        if (special < end && *special == '"') {
+            pos = special + 1 - text;
+            return JSONValue(StringRef(start, special - start));
+        }
+
+        // Copy the runs between escapes in bulk, resolving each escape
+        std::string result;
+        while (true) {
+            if (special >= end) {
+                throw std::runtime_error("Unterminated string");
+            }
+            result.append(start, special - start);
+
+            // Check for end of string
+            if (*special == '"') break;
+
+            // Handle escape characters
+            char next = special + 1 < end ? special[1] : '\0';
+            if (next == '"' || next == '\\' || next == '/') {
+                result += next;
+            } else {
+                throw std::runtime_error("Invalid escape character in string");
+            }
+            start = special + 2;
+            special = scanner.findQuoteOrEscape(start, end);
+        }
+        pos = special + 1 - text;
+
+        // Escaped strings are copied into the arena
+        char* chars = arena.allocateArray<char>(result.length());
+        std::memcpy(chars, result.data(), result.length());
+        return JSONValue(StringRef(chars, result.length()));
+    }
+
+    JSONValue parseNumber() {
+        double value;
+        const char* next = parseNumberText(text + pos, text + length, value);
+        if (!next) {
+            throw std::runtime_error("Invalid number in JSON");
+        }
+        pos = next - text;
+        return JSONValue(value);
+    }
+};
+
+// Parsed document saved to disk, so repeated queries against the same file
+// skip parsing. The file holds a header, the document tree laid out as in
+// memory but with every pointer replaced by its offset in the file, and the
+// object keys the tree uses, numbered from 0 in the order they first occur.
+// Loading maps the file read-only and interns its keys; the tree is used
+// where it lies. Values read from the file are resolved one at a time as
+// they are visited: the offsets they hold are checked against the file and
+// turned into addresses, and arrays and objects are marked with the
+// cache's slot so their children are resolved in turn (see JSONValue).
+// Loading therefore takes time in proportion to the number of distinct
+// keys, and evaluating touches only the pages it reads. A cache is stale
+// when the source's size or modification time differ from the recorded
+// ones and unusable if its header, keys or root fail a check; callers then
+// parse the source. Damage found further down the tree fails the
+// evaluation that reaches it. Caches are only ever replaced by rename, so
+// a mapped one is never truncated underneath its reader.
+class DocumentCache {
+public:
+    ~DocumentCache() {
+        {
+            std::lock_guard<std::mutex> lock(registryLock());
+            registry()[slot] = nullptr;
+        }
+        munmap(const_cast<char*>(base), length);
+    }
+
+    DocumentCache(const DocumentCache&) = delete;
+    DocumentCache& operator=(const DocumentCache&) = delete;
+
+    const JSONValue& root() const { return rootValue; }
+
+    size_t size() const { return length; }
+
+    // The cache in `slot`, which a value read from it names
+    static const DocumentCache& at(uint16_t slot) { return *registry()[slot]; }
+
+    // The cache at `path` if it is current for a source file with status
+    // `source` and intact, otherwise nullptr. Interns the cached keys.
+    static std::unique_ptr<DocumentCache> open(const std::string& path, const struct stat& source) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+
+        Header header;
+        struct stat info;
+        bool current = pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+                       fstat(fd, &info) == 0 && std::memcmp(header.magic, magicTag(), sizeof(header.magic)) == 0 &&
+                       header.version == version && header.valueSize == sizeof(JSONValue) &&
+                       header.fileSize == static_cast<uint64_t>(info.st_size) && matches(header, source) &&
+                       header.rootOffset % alignof(JSONValue) == 0 && header.rootOffset >= sizeof(Header) &&
+                       header.keysOffset >= header.rootOffset + sizeof(JSONValue) &&
+                       header.keysOffset <= header.fileSize;
+        void* addr = current ? mmap(nullptr, header.fileSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (addr == MAP_FAILED) return nullptr;
+        std::unique_ptr<DocumentCache> cache(new DocumentCache(static_cast<const char*>(addr), header.fileSize));
+
+        try {
+            if (!cache->loadKeys(header) || !cache->claimSlot()) return nullptr;
+            cache->rootValue = cache->read(reinterpret_cast<const JSONValue*>(cache->base + header.rootOffset));
+        } catch (const std::exception&) {
+            return nullptr; // the key table is full or the root is damaged
+        }
+        return cache;
+    }
+
+    // Saves `root`, parsed from a source file with status `source`, to
+    // `path`. The file is written under a temporary name of this process
+    // and call, and renamed, so concurrent readers see either the old
+    // cache or the new one. Returns false if it cannot be written.
+    static bool write(const std::string& path, const JSONValue& root, const struct stat& source) {
+        static std::atomic<unsigned> writes(0);
+        std::string temporary = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(writes++);
+        Writer writer(temporary);
+        if (!writer.file) return false;
+
+        Header header = {};
+        std::memcpy(header.magic, magicTag(), sizeof(header.magic));
+        header.version = version;
+        header.valueSize = sizeof(JSONValue);
+        header.sourceSize = static_cast<uint64_t>(source.st_size);
+        header.sourceSeconds = source.st_mtim.tv_sec;
+        header.sourceNanoseconds = source.st_mtim.tv_nsec;
+        writer.append(&header, sizeof(header), 1);
+
+        JSONValue copy = writer.copy(root);
+        header.rootOffset = writer.append(&copy, sizeof(copy), alignof(JSONValue));
+
+        // Keys as a 32-bit length followed by the characters
+        header.keyCount = writer.keys.size();
+        header.keysOffset = writer.offset;
+        for (KeyId id : writer.keys) {
+            StringRef name = KeyTable::global().name(id);
+            uint32_t nameLength = static_cast<uint32_t>(name.length);
+            writer.append(&nameLength, sizeof(nameLength), 1);
+            writer.append(name.data, name.length, 1);
+        }
+
+        header.fileSize = writer.offset;
+        writer.file.seekp(0);
+        writer.file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writer.file.close();
+        if (!writer.file || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // The value stored at `stored`, a JSONValue in the file, with its
+    // offset turned into an address. The block it points to must lie
+    // inside the file, after the header, and end at or before `stored`:
+    // write() puts every block before the value holding it, so each step
+    // down the tree moves towards the start of the file and no damaged
+    // file can lead in a cycle. Throws if a check fails.
+    JSONValue read(const JSONValue* stored) const {
+        StoredValue raw;
+        std::memcpy(&raw, stored, sizeof(raw));
+        uint64_t limit = static_cast<uint64_t>(reinterpret_cast<const char*>(stored) - base);
+        JSONValue value;
+        switch (static_cast<JSONValueType>(raw.type)) {
+            case JSONValueType::Null:
+                return value;
+            case JSONValueType::Number: {
+                double number;
+                std::memcpy(&number, &raw.payload, sizeof(number));
+                return JSONValue(number);
+            }
+            case JSONValueType::String:
+                return JSONValue(StringRef(block(raw.payload, raw.length, 1, limit), raw.length));
+            case JSONValueType::Array:
+                if (raw.length == 0) {
+                    return JSONValue(static_cast<const JSONValue*>(nullptr), 0);
+                } else if (raw.packed) {
+                    const char* numbers = block(raw.payload, uint64_t(raw.length) * sizeof(double), alignof(double),
+                                                limit);
+                    return JSONValue::packedArray(reinterpret_cast<const double*>(numbers), raw.length);
+                }
+                value = JSONValue(reinterpret_cast<const JSONValue*>(block(
+                                      raw.payload, uint64_t(raw.length) * sizeof(JSONValue), alignof(JSONValue), limit)),
+                                  raw.length);
+                value.cache = slot;
+                return value;
+            case JSONValueType::Object: {
+                // The header gives the size of the block, so it is checked
+                // on its own first
+                const JSONObject* object =
+                    reinterpret_cast<const JSONObject*>(block(raw.payload, sizeof(JSONObject), alignof(JSONObject), limit));
+                block(raw.payload, sizeof(JSONObject) + uint64_t(object->count) * (sizeof(JSONValue) + sizeof(KeyId)),
+                      alignof(JSONObject), limit);
+                value = JSONValue(object);
+                value.cache = slot;
+                return value;
+            }
+            default:
+                damaged();
+        }
+    }
+
+    // Member `key` of an object read from this cache, as JSONValue::findMember
+    bool findMember(const JSONObject* object, KeyId key, JSONValue& value) const {
+        KeyId stored;
+        if (!fileKey(key, stored)) return false;
+        size_t position = object->count;
+        if (object->index) {
+            // Written before the object, holding file key ids; probing is
+            // bounded in case no slot is empty
+            uint64_t slots = uint64_t(object->indexMask) + 1;
+            if ((slots & (slots - 1)) != 0 || slots <= object->count) damaged();
+            const JSONObject::IndexSlot* index = reinterpret_cast<const JSONObject::IndexSlot*>(
+                block(reinterpret_cast<uint64_t>(object->index), slots * sizeof(JSONObject::IndexSlot),
+                      alignof(JSONObject::IndexSlot), reinterpret_cast<const char*>(object) - base));
+            uint32_t slot = JSONObject::indexSlot(stored, object->indexMask);
+            for (uint64_t probe = 0; probe < slots && index[slot].position != 0; ++probe) {
+                if (index[slot].key == stored) {
+                    position = index[slot].position - 1;
+                    if (position >= object->count) damaged();
+                    break;
+                }
+                slot = (slot + 1) & object->indexMask;
+            }
+        } else {
+            position = findKeyId(object->keys(), object->count, stored);
+        }
+        if (position >= object->count) return false;
+        value = read(object->values() + position);
+        return true;
+    }
+
+    KeyId memberKey(const JSONObject* object, size_t index) const {
+        KeyId stored = object->key(index);
+        if (stored >= processKeys.size()) damaged();
+        return processKeys[stored];
+    }
+
+    JSONValue memberValue(const JSONObject* object, size_t index) const { return read(object->values() + index); }
+
+private:
+    static const char* magicTag() { return "JEVCACHE"; }
+    static const uint32_t version = 3;
+
+    // Caches in use, by slot; slot 0 stays empty, as a JSONValue::cache of
+    // 0 means none
+    static const size_t slotCount = size_t(1) << 16;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t valueSize; // sizeof(JSONValue) of the writer
+        uint64_t fileSize;
+        uint64_t sourceSize;
+        int64_t sourceSeconds;
+        int64_t sourceNanoseconds;
+        uint64_t keyCount;
+        uint64_t keysOffset;
+        uint64_t rootOffset;
+    };
+
+    // A JSONValue as the file holds it, read without trusting its bytes
+    struct StoredValue {
+        uint8_t type;
+        uint8_t packed;
+        uint16_t cache; // not used in the file
+        uint32_t length;
+        uint64_t payload; // number bits or offset
+    };
+    static_assert(sizeof(StoredValue) == sizeof(JSONValue), "StoredValue must match JSONValue");
+    static_assert(offsetof(JSONValue, length) == offsetof(StoredValue, length), "StoredValue must match JSONValue");
+    static_assert(offsetof(JSONValue, numberValue) == offsetof(StoredValue, payload),
+                  "StoredValue must match JSONValue");
+
+    // Appends the tree to a file in post-order, so every block a value
+    // points to has been written, and its offset is known, before it,
+    // which is what read() checks.
+    struct Writer {
+        std::ofstream file;
+        uint64_t offset = 0;
+        std::vector<KeyId> keys;                    // process key id of each file key id
+        std::unordered_map<KeyId, KeyId> fileKeys;  // and the reverse
+        std::vector<KeyId> objectKeys;              // keys of the object being written
+
+        explicit Writer(const std::string& path) : file(path, std::ios::binary | std::ios::trunc) {}
+
+        // Offset of `size` bytes at `data` in the file
+        uint64_t append(const void* data, size_t size, size_t align) {
+            static const char padding[16] = {};
+            size_t pad = (align - offset % align) % align;
+            file.write(padding, pad);
+            file.write(static_cast<const char*>(data), size);
+            offset += pad + size;
+            return offset - size;
+        }
+
+        // An offset stored where the tree holds a pointer
+        template <typename T>
+        const T* appendArray(const T* items, size_t count) {
+            return reinterpret_cast<const T*>(append(items, sizeof(T) * count, alignof(T)));
+        }
+
+        KeyId fileKey(KeyId id) {
+            auto inserted = fileKeys.emplace(id, static_cast<KeyId>(keys.size()));
+            if (inserted.second) keys.push_back(id);
+            return inserted.first->second;
+        }
+
+        // `value` with its storage written to the file. Children are
+        // written before their container, tracked on an explicit stack so
+        // documents of any depth can be cached.
+        JSONValue copy(const JSONValue& root) {
+            struct Frame {
+                JSONValue container;
+                size_t base; // first copied child in `copied`
+            };
+            std::vector<Frame> frames;
+            std::vector<JSONValue> copied; // copied children of the open containers
+            JSONValue value = root;
+            while (true) {
+                if (childCount(value) > 0) {
+                    frames.push_back(Frame{value, copied.size()});
+                } else {
+                    copied.push_back(copyLeaf(value));
+                }
+
+                // Write out every container whose children are all copied
+                while (!frames.empty() && copied.size() - frames.back().base == childCount(frames.back().container)) {
+                    const Frame& frame = frames.back();
+                    JSONValue container = copyContainer(frame.container, copied.data() + frame.base);
+                    copied.resize(frame.base);
+                    copied.push_back(container);
+                    frames.pop_back();
+                }
+                if (frames.empty()) return copied.back();
+
+                const Frame& frame = frames.back();
+                size_t next = copied.size() - frame.base;
+                value = frame.container.type == JSONValueType::Array ? frame.container.arrayPtr[next]
+                                                                     : frame.container.objectValue().value(next);
+            }
+        }
+
+        // Children still to copy: none for scalars, empty and packed arrays
+        static size_t childCount(const JSONValue& value) {
+            if (value.type == JSONValueType::Array) return value.packed ? 0 : value.length;
+            if (value.type == JSONValueType::Object) return value.objectValue().size();
+            return 0;
+        }
+
+        JSONValue copyLeaf(const JSONValue& value) {
+            switch (value.type) {
+                case JSONValueType::String:
+                    return JSONValue(StringRef(appendArray(value.stringPtr, value.length), value.length));
+                case JSONValueType::Array:
+                    if (value.length == 0) return JSONValue(static_cast<const JSONValue*>(nullptr), 0);
+                    return JSONValue::packedArray(appendArray(value.numbersPtr, value.length), value.length);
+                case JSONValueType::Object:
+                    return copyContainer(value, nullptr);
+                default:
+                    return value;
+            }
+        }
+
+        // `value` pointing at its children's copies, `children`
+        JSONValue copyContainer(const JSONValue& value, const JSONValue* children) {
+            if (value.type == JSONValueType::Array) {
+                return JSONValue(appendArray(children, value.length), value.length);
+            }
+            const JSONObject& object = value.objectValue();
+            objectKeys.resize(object.size());
+            for (size_t i = 0; i < object.size(); ++i) {
+                objectKeys[i] = fileKey(object.key(i));
+            }
+            // The index is laid out again for the file key ids
+            JSONObject header = object;
+            if (object.index) {
+                std::vector<JSONObject::IndexSlot> index(object.indexMask + 1, JSONObject::IndexSlot{0, 0});
+                for (uint32_t i = 0; i < object.count; ++i) {
+                    uint32_t slot = JSONObject::indexSlot(objectKeys[i], object.indexMask);
+                    while (index[slot].position != 0) slot = (slot + 1) & object.indexMask;
+                    index[slot] = JSONObject::IndexSlot{objectKeys[i], i + 1};
+                }
+                header.index = appendArray(index.data(), index.size());
+            }
+            const JSONObject* block = appendArray(&header, 1);
+            appendArray(children, object.size());
+            appendArray(objectKeys.data(), objectKeys.size());
+            return JSONValue(block);
+        }
+    };
+
+    const char* base;
+    size_t length;
+    uint16_t slot = 0;
+    JSONValue rootValue;
+    std::vector<KeyId> processKeys;                // process key id of each file key id
+    std::vector<JSONObject::IndexSlot> fileKeyIndex; // file key id + 1 by process key id
+    uint32_t fileKeyMask = 0;
+
+    DocumentCache(const char* base, size_t length) : base(base), length(length) {}
+
+    static std::mutex& registryLock() {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static DocumentCache** registry() {
+        static DocumentCache* caches[slotCount] = {};
+        return caches;
+    }
+
+    // Takes a free slot in the registry; false if every one is in use
+    bool claimSlot() {
+        std::lock_guard<std::mutex> lock(registryLock());
+        static size_t next = 1;
+        for (size_t tried = 1; tried < slotCount; ++tried) {
+            size_t candidate = next;
+            next = next + 1 < slotCount ? next + 1 : 1;
+            if (!registry()[candidate]) {
+                registry()[candidate] = this;
+                slot = static_cast<uint16_t>(candidate);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    [[noreturn]] static void damaged() { throw std::runtime_error("Damaged document cache"); }
+
+    // Address of the block of `size` bytes at offset `offset`, which must
+    // end at or before offset `limit`
+    const char* block(uint64_t offset, uint64_t size, size_t align, uint64_t limit) const {
+        if (offset % align != 0 || offset < sizeof(Header) || offset > limit || limit - offset < size) damaged();
+        return base + offset;
+    }
+
+    static bool matches(const Header& header, const struct stat& source) {
+        return header.sourceSize == static_cast<uint64_t>(source.st_size) &&
+               header.sourceSeconds == source.st_mtim.tv_sec &&
+               header.sourceNanoseconds == source.st_mtim.tv_nsec;
+    }
+
+    // Interns the cached keys, filling processKeys and the index from
+    // process key ids back to file key ids
+    bool loadKeys(const Header& header) {
+        uint64_t at = header.keysOffset;
+        if (header.keyCount > (length - at) / sizeof(uint32_t)) return false;
+        processKeys.reserve(header.keyCount);
+        for (uint64_t id = 0; id < header.keyCount; ++id) {
+            uint32_t nameLength;
+            if (length - at < sizeof(nameLength)) return false;
+            std::memcpy(&nameLength, base + at, sizeof(nameLength));
+            at += sizeof(nameLength);
+            if (length - at < nameLength) return false;
+            processKeys.push_back(KeyTable::global().intern(StringRef(base + at, nameLength)));
+            at += nameLength;
+        }
+        if (at != length) return false;
+
+        // At most half full, so probes stay short
+        size_t slots = 2;
+        while (slots < 2 * processKeys.size()) slots *= 2;
+        fileKeyIndex.assign(slots, JSONObject::IndexSlot{0, 0});
+        fileKeyMask = static_cast<uint32_t>(slots - 1);
+        for (uint32_t id = 0; id < processKeys.size(); ++id) {
+            uint32_t slot = JSONObject::indexSlot(processKeys[id], fileKeyMask);
+            while (fileKeyIndex[slot].position != 0) slot = (slot + 1) & fileKeyMask;
+            fileKeyIndex[slot] = JSONObject::IndexSlot{processKeys[id], id + 1};
+        }
+        return true;
+    }
+
+    // The file's id for process key `key`; false if the file has no such key
+    bool fileKey(KeyId key, KeyId& stored) const {
+        for (uint32_t slot = JSONObject::indexSlot(key, fileKeyMask); fileKeyIndex[slot].position != 0;
+             slot = (slot + 1) & fileKeyMask) {
+            if (fileKeyIndex[slot].key == key) {
+                stored = fileKeyIndex[slot].position - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+inline JSONValue cachedValue(uint16_t slot, const JSONValue* stored) {
+    return DocumentCache::at(slot).read(stored);
+}
+
+inline bool JSONValue::findMember(KeyId key, JSONValue& value) const {
+    if (cache) return DocumentCache::at(cache).findMember(objectPtr, key, value);
+    const JSONValue* member = objectPtr->find(key);
+    if (member) value = *member;
+    return member != nullptr;
+}
+
+inline KeyId JSONValue::memberKey(size_t index) const {
+    return cache ? DocumentCache::at(cache).memberKey(objectPtr, index) : objectPtr->key(index);
+}
+
+inline JSONValue JSONValue::memberValue(size_t index) const {
+    return cache ? DocumentCache::at(cache).memberValue(objectPtr, index) : objectPtr->value(index);
+}
+
+// Lexer
+enum class TokenType {
+    Identifier, Number, String, LParen, RParen, LBracket, RBracket, Comma,
+    Dot, Plus, Minus, Asterisk, Slash, Less, LessEqual, Greater, GreaterEqual,
+    Equal, NotEqual, Question, At, End
+};
+
+struct Token {
+    TokenType type;
+    std::string value;
+    double number; // parsed value of a Number token, 0 for the others
+
+    Token() : type(TokenType::End), number(0) {}
+    Token(TokenType type, std::string value, double number = 0)
+        : type(type), value(std::move(value)), number(number) {}
+};
+
+class Lexer {
+public:
+    Lexer(const std::string& text) : text(text), pos(0) {}
+
+    Token getNextToken() {
+        skipWhitespace();
+
+        // Check for end of text
+        if (pos >= text.length()) {
+            return Token{TokenType::End, ""};
+        }
+
+        // Check for identifiers
+        char c = peek();
+        if (isalpha(c) || c == '_') {
+            return identifier();
+        }
+
+        // Check for numbers
+        if (isdigit(c)) {
+            return number();
+        }
+
+        // Check for negative numbers or minus operator
+        if (c == '-') {
+            char nextChar = peekNextChar();
+            if (isdigit(nextChar) || nextChar == '.') {
+                return number();
+            } else {
+                pos++; // Consume '-'
+                return Token{TokenType::Minus, "-"};
+            }
+        }
+
+        // Check for strings
+        if (c == '"') {
+            return string();
+        }
+
+        // Check for single-character tokens
+        switch (c) {
+            case '+': pos++; return Token{TokenType::Plus, "+"};
+            case '*': pos++; return Token{TokenType::Asterisk, "*"};
+            case '/': pos++; return Token{TokenType::Slash, "/"};
+            case '(': pos++; return Token{TokenType::LParen, "("};
+            case ')': pos++; return Token{TokenType::RParen, ")"};
+            case '[': pos++; return Token{TokenType::LBracket, "["};
+            case ']': pos++; return Token{TokenType::RBracket, "]"};
+            case ',': pos++; return Token{TokenType::Comma, ","};
+            case '.': pos++; return Token{TokenType::Dot, "."};
+            case '?': pos++; return Token{TokenType::Question, "?"};
+            case '@': pos++; return Token{TokenType::At, "@"};
+            case '<':
+                pos++;
+                if (peek() == '=') {
+                    pos++;
+                    return Token{TokenType::LessEqual, "<="};
+                }
+                return Token{TokenType::Less, "<"};
+            case '>':
+                pos++;
+                if (peek() == '=') {
+                    pos++;
+                    return Token{TokenType::GreaterEqual, ">="};
+                }
+                return Token{TokenType::Greater, ">"};
+            case '=':
+            case '!':
+                // Only as == and !=
+                if (peekNextChar() == '=') {
+                    pos += 2;
+                    return c == '=' ? Token{TokenType::Equal, "=="} : Token{TokenType::NotEqual, "!="};
+                }
+                throw std::runtime_error(std::string("Unknown character in expression: ") + c);
+            default:
+                throw std::runtime_error(std::string("Unknown character in expression: ") + c);
+        }
+    }
+
+private:
+    std::string text;
+    size_t pos;
+
+    char peek() {
+        if (pos < text.length()) {
+            return text[pos];
+        }
+        return '\0';
+    }
+
+    char peekNextChar() {
+        size_t nextPos = pos + 1;
+        if (nextPos < text.length()) {
+            return text[nextPos];
+        }
+        return '\0';
+    }
+
+    void skipWhitespace() {
+        while (pos < text.length() && isspace(text[pos])) {
+            pos++;
+        }
+    }
+
+    Token identifier() {
+        size_t start = pos;
+        while (isalnum(peek()) || peek() == '_') {
+            pos++;
+        }
+        return Token{TokenType::Identifier, text.substr(start, pos - start)};
+    }
+
+    Token number() {
+        size_t start = pos;
+        double value;
+        const char* next = parseNumberText(text.data() + pos, text.data() + text.length(), value);
+        if (!next) {
+            throw std::runtime_error("Invalid number in expression");
+        }
+        pos = next - text.data();
+        return Token{TokenType::Number, text.substr(start, pos - start), value};
+    }
+
+    Token string() {
+        std::string result;
+
+        // Consume '"'
+        get();
+
+        // Parse string characters; the text may end before the closing quote
+        while (true) {
+            if (pos >= text.length()) throw std::runtime_error("Unterminated string in expression");
+            char c = get();
+            if (c == '"') break;
+
+            // Handle escape characters
+            if (c == '\\') {
+                if (pos >= text.length()) throw std::runtime_error("Unterminated string in expression");
+                char next = get();
+                if (next == '"' || next == '\\' || next == '/') {
+                    result += next;
+                } else {
+                    throw std::runtime_error("Invalid escape character in string");
+                }
+            } else {
+                result += c;
+            }
+        }
+
+        // Return the string token
+        return Token{TokenType::String, result};
+    }
+
+    char get() {
+        if (pos < text.length()) {
+            return text[pos++];
+        }
+        return '\0';
+    }
+};
+
+// Abstract Syntax Tree Nodes. Nodes refer to their children by plain
+// pointer; the whole tree is owned by the Arena the Parser allocated it in.
+enum class ExprKind : uint8_t {
+    Number,
+    String,
+    Identifier,
+    BinaryOp,
+    UnaryOp,
+    FunctionCall,
+    Subscript,
+    MemberAccess,
+    Path,
+    Current,
+    Projection
+};
+
+struct Expression {
+    // Base class for all expression nodes; `kind` says which one it is.
+    // `height` is the number of nodes on the longest path down from this
+    // one when it was built, which bounds the recursion of everything that
+    // walks the tree (rewriting only ever makes trees shallower).
+    const ExprKind kind;
+    uint32_t height;
+    explicit Expression(ExprKind kind, uint32_t height = 1) : kind(kind), height(height) {}
+    virtual ~Expression() = default;
+};
+
+// Height of a node with the given children
+inline uint32_t heightAbove(const Expression* child) {
+    return child ? child->height + 1 : 1;
+}
+
+inline uint32_t heightAbove(const Expression* left, const Expression* right) {
+    return std::max(left->height, right->height) + 1;
+}
+
+// Number expression
+struct NumberExpr : public Expression {
+    double value;
+    NumberExpr(double value) : Expression(ExprKind::Number), value(value) {}
+};
+
+// String expression
+struct StringExpr : public Expression {
+    std::string value;
+    StringExpr(std::string value) : Expression(ExprKind::String), value(std::move(value)) {}
+};
+
+// Identifier expression
+struct IdentifierExpr : public Expression {
+    std::string name;
+    IdentifierExpr(std::string name) : Expression(ExprKind::Identifier), name(std::move(name)) {}
+};
+
+// Binary operation expression: left op right. Comparisons are '<', '>',
+// 'L' (<=), 'G' (>=), '=' (==) and '!' (!=).
+struct BinaryOpExpr : public Expression {
+    char op;
+    Expression* left;
+    Expression* right;
+    BinaryOpExpr(char op, Expression* left, Expression* right)
+        : Expression(ExprKind::BinaryOp, heightAbove(left, right)), op(op), left(left), right(right) {}
+};
+
+// Unary operation expression: op operand
+struct UnaryOpExpr : public Expression {
+    char op;
+    Expression* operand;
+    UnaryOpExpr(char op, Expression* operand)
+        : Expression(ExprKind::UnaryOp, heightAbove(operand)), op(op), operand(operand) {}
+};
+
+// Function call expression: functionName(expr1, expr2, ...)
+struct FunctionCallExpr : public Expression {
+    std::string functionName;
+    std::vector<Expression*> arguments;
+    FunctionCallExpr(std::string functionName, std::vector<Expression*> arguments)
+        : Expression(ExprKind::FunctionCall),
+          functionName(std::move(functionName)),
+          arguments(std::move(arguments)) {
+        for (const Expression* argument : this->arguments) {
+            height = std::max(height, heightAbove(argument));
+        }
+    }
+};
+
+// Subscript expression: base[index]
+struct SubscriptExpr : public Expression {
+    Expression* base;
+    Expression* index;
+    SubscriptExpr(Expression* base, Expression* index)
+        : Expression(ExprKind::Subscript, heightAbove(base, index)), base(base), index(index) {}
+};
+
+// Member access expression: base.member
+struct MemberAccessExpr : public Expression {
+    Expression* base;
+    std::string member;
+    MemberAccessExpr(Expression* base, std::string member)
+        : Expression(ExprKind::MemberAccess, heightAbove(base)), base(base), member(std::move(member)) {}
+};
+
+// The array element a projection is at: @ in a filter, and the implicit
+// base of names in a filter and of the steps after a projection
+struct CurrentExpr : public Expression {
+    CurrentExpr() : Expression(ExprKind::Current) {}
+};
+
+// Projection over the elements of an array: source[*] or source[?filter],
+// with the steps that follow applied to each element. `filter` (if any)
+// and `element` are evaluated with each element of `source` as the
+// current one; elements whose filter is 0 are skipped. The value is the
+// array of the `element` results, flattened when `element` is itself a
+// projection. Aggregate functions fold the results as they are produced
+// instead of building the array.
+struct ProjectionExpr : public Expression {
+    Expression* source;
+    Expression* filter; // nullptr for [*]
+    Expression* element;
+    ProjectionExpr(Expression* source, Expression* filter, Expression* element)
+        : Expression(ExprKind::Projection), source(source), filter(filter), element(element) {
+        updateHeight();
+    }
+
+    // Steps are added to `element` after construction
+    void updateHeight() {
+        height = std::max(heightAbove(source, element), heightAbove(filter));
+    }
+
+    // source[*] on its own, whose value is the source array itself
+    bool isIdentity() const { return !filter && element->kind == ExprKind::Current; }
+};
+
+// One step of a path: an identifier looked up in the document root (only
+// ever the first step), a member access (.name), a literal key subscript
+// (["name"]) or a literal index subscript ([2]). Key and Index steps fail
+// with the same errors as the subscript they replace.
+enum class PathStepKind : uint8_t {
+    Identifier,
+    Member,
+    Key,
+    Index
+};
+
+struct PathStep {
+    PathStepKind kind;
+    std::string key;
+    size_t index;
+};
+
+// Path expression built by the Optimizer: steps applied to base, or to
+// the document root when base is nullptr
+struct PathExpr : public Expression {
+    Expression* base;
+    std::vector<PathStep> steps;
+    PathExpr(Expression* base, std::vector<PathStep> steps)
+        : Expression(ExprKind::Path, heightAbove(base)), base(base), steps(std::move(steps)) {}
+};
+
+// Parser
+class Parser {
+public:
+    // Deepest expression accepted, counting both nested parentheses,
+    // subscripts and calls and the height of the tree built. The optimizer,
+    // compiler and access collection recurse over the tree, so this keeps
+    // them well inside the native stack. Unlike maxNestingDepth() it is
+    // fixed, since raising it would risk overflowing that stack; json_eval.h
+    // and the --max-depth docs say so.
+    static const uint32_t maxDepth = 1000;
+
+    // Construct the Parser with a Lexer; AST nodes are allocated from
+    // `arena` and released together with it
+    Parser(Lexer& lexer, Arena& arena) : lexer(lexer), arena(arena), nesting(0), filters(0) {
+        currentToken = lexer.getNextToken();
+    }
+
+    // Parse the expression
+    Expression* parseExpression() {
+        if (++nesting > maxDepth) throw std::runtime_error("Expression nested too deeply");
+        Expression* expr = parseComparison();
+        --nesting;
+        return expr;
+    }
+
+private:
+    Lexer& lexer;
+    Arena& arena;
+    Token currentToken;
+    uint32_t nesting; // parseExpression calls in progress
+    uint32_t filters; // filter conditions being parsed, in which names are members of the element
+
+    // Allocate a node, rejecting trees too tall to walk safely
+    template <typename T, typename... Args>
+    Expression* node(Args&&... args) {
+        Expression* expr = arena.make<T>(std::forward<Args>(args)...);
+        if (expr->height > maxDepth) throw std::runtime_error("Expression nested too deeply");
+        return expr;
+    }
+
+    // Consume the current token and move to the next one
+    void eat(TokenType type) {
+        if (currentToken.type == type) {
+            currentToken = lexer.getNextToken();
+        } else {
+            throw std::runtime_error("Unexpected token");
+        }
+    }
+
+    // Parse comparisons, which bind more loosely than arithmetic
+    Expression* parseComparison() {
+        Expression* left = parseAddSubtract();
+        while (true) {
+            char op;
+            switch (currentToken.type) {
+                case TokenType::Less: op = '<'; break;
+                case TokenType::LessEqual: op = 'L'; break;
+                case TokenType::Greater: op = '>'; break;
+                case TokenType::GreaterEqual: op = 'G'; break;
+                case TokenType::Equal: op = '='; break;
+                case TokenType::NotEqual: op = '!'; break;
+                default: return left;
+            }
+            eat(currentToken.type);
+            Expression* right = parseAddSubtract();
+            left = node<BinaryOpExpr>(op, left, right);
+        }
+    }
+
+    // Parse addition and subtraction
+    Expression* parseAddSubtract() {
+        Expression* left = parseMultiplyDivide();
+        while (currentToken.type == TokenType::Plus || currentToken.type == TokenType::Minus) {
+            char op = (currentToken.type == TokenType::Plus) ? '+' : '-';
+            eat(currentToken.type);
+            Expression* right = parseMultiplyDivide();
+            left = node<BinaryOpExpr>(op, left, right);
+        }
+        return left;
+    }
+
+    // Parse multiplication and division
+    Expression* parseMultiplyDivide() {
+        Expression* left = parseUnary();
+        while (currentToken.type == TokenType::Asterisk || currentToken.type == TokenType::Slash) {
+            char op = (currentToken.type == TokenType::Asterisk) ? '*' : '/';
+            eat(currentToken.type);
+            Expression* right = parseUnary();
+            left = node<BinaryOpExpr>(op, left, right);
+        }
+        return left;
+    }
+
+    // Parse unary operators; a run of them is counted, not recursed into
+    Expression* parseUnary() {
+        size_t negations = 0;
+        while (currentToken.type == TokenType::Minus) {
+            eat(TokenType::Minus);
+            negations++;
+        }
+        Expression* expr = parseSubscript();
+        for (; negations > 0; --negations) {
+            expr = node<UnaryOpExpr>('-', expr);
+        }
+        return expr;
+    }
+
+    // Parse subscripts, member access and projections. Steps after a
+    // projection apply to each element, so they extend the element of the
+    // innermost projection (`target`) rather than the whole expression.
+    Expression* parseSubscript() {
+        Expression* expr = parsePrimary();
+        Expression** target = &expr;
+        std::vector<ProjectionExpr*> projections;
+        while (true) {
+            if (currentToken.type == TokenType::LBracket) {
+                eat(TokenType::LBracket);
+                if (currentToken.type == TokenType::Asterisk || currentToken.type == TokenType::Question) {
+                    // Parse projection or filter
+                    Expression* filter = nullptr;
+                    if (currentToken.type == TokenType::Asterisk) {
+                        eat(TokenType::Asterisk);
+                    } else {
+                        eat(TokenType::Question);
+                        ++filters;
+                        filter = parseExpression();
+                        --filters;
+                    }
+                    eat(TokenType::RBracket);
+                    ProjectionExpr* projection = arena.make<ProjectionExpr>(*target, filter, node<CurrentExpr>());
+                    *target = projection;
+                    target = &projection->element;
+                    projections.push_back(projection);
+                } else { // Parse subscript
+                    Expression* index = parseExpression();
+                    eat(TokenType::RBracket);
+                    *target = node<SubscriptExpr>(*target, index);
+                }
+            } else if (currentToken.type == TokenType::Dot) { // Parse member access
+                eat(TokenType::Dot);
+                if (currentToken.type != TokenType::Identifier) {
+                    throw std::runtime_error("Expected identifier after '.'");
+                }
+                std::string member = std::move(currentToken.value);
+                eat(TokenType::Identifier);
+                *target = node<MemberAccessExpr>(*target, std::move(member));
+            } else {
+                break;
+            }
+        }
+
+        // Each projection's element is complete now; innermost first
+        for (auto it = projections.rbegin(); it != projections.rend(); ++it) {
+            (*it)->updateHeight();
+            if ((*it)->height > maxDepth) throw std::runtime_error("Expression nested too deeply");
+        }
+        return expr;
+    }
+
+    Expression* parsePrimary() {
+        if (currentToken.type == TokenType::Number) { // Number
+            double value = currentToken.number;
+            eat(TokenType::Number);
+            return node<NumberExpr>(value);
+        } else if (currentToken.type == TokenType::String) { // String
+            std::string value = std::move(currentToken.value);
+            eat(TokenType::String);
+            return node<StringExpr>(std::move(value));
+        } else if (currentToken.type == TokenType::Identifier) { // Identifier or function call
+            std::string name = std::move(currentToken.value);
+            eat(TokenType::Identifier);
+            if (currentToken.type == TokenType::LParen) {
+                // Function call
+                eat(TokenType::LParen);
+                std::vector<Expression*> args;
+                if (currentToken.type != TokenType::RParen) {
+                    do {
+                        args.push_back(parseExpression());
+                        if (currentToken.type == TokenType::Comma) {
+                            eat(TokenType::Comma);
+                        } else {
+                            break;
+                        }
+                    } while (true);
+                }
+                eat(TokenType::RParen);
+                return node<FunctionCallExpr>(std::move(name), std::move(args));
+            } else if (filters > 0) {
+                // Member of the element a filter is testing
+                return node<MemberAccessExpr>(node<CurrentExpr>(), std::move(name));
+            } else {
+                // Identifier
+                return node<IdentifierExpr>(std::move(name));
+            }
+        } else if (currentToken.type == TokenType::LParen) { // Parenthesized expression
+            eat(TokenType::LParen);
+            Expression* expr = parseExpression();
+            eat(TokenType::RParen);
+            return expr;
+        } else if (currentToken.type == TokenType::At) { // The element a filter is testing
+            if (filters == 0) throw std::runtime_error("'@' is only allowed in a filter");
+            eat(TokenType::At);
+            return node<CurrentExpr>();
+        } else {
+            throw std::runtime_error("Invalid expression");
+        }
+    }
+};
+
+// Record in `root` the document paths `expr` reads. Returns the node for
+// `expr` itself when it is a path into the document (an identifier
+// followed by member accesses and literal subscripts), otherwise nullptr.
+inline AccessTree* collectAccess(Expression* expr, AccessTree& root);
+
+// Record the paths read by an expression whose whole value is used
+inline void collectValueAccess(Expression* expr, AccessTree& root) {
+    if (AccessTree* node = collectAccess(expr, root)) {
+        node->whole = true;
+    }
+}
+
+inline AccessTree* collectAccess(Expression* expr, AccessTree& root) {
+    switch (expr->kind) {
+        case ExprKind::Identifier:
+            return &root.member(static_cast<IdentifierExpr*>(expr)->name);
+        case ExprKind::MemberAccess: {
+            auto memberExpr = static_cast<MemberAccessExpr*>(expr);
+            AccessTree* base = collectAccess(memberExpr->base, root);
+            return base ? &base->member(memberExpr->member) : nullptr;
+        }
+        case ExprKind::Subscript: {
+            auto subExpr = static_cast<SubscriptExpr*>(expr);
+            AccessTree* base = collectAccess(subExpr->base, root);
+            if (subExpr->index->kind == ExprKind::String) {
+                return base ? &base->member(static_cast<StringExpr*>(subExpr->index)->value) : nullptr;
+            }
+            if (subExpr->index->kind == ExprKind::Number) {
+                // Negative indices fail at evaluation time whatever the data
+                int64_t idx = arrayIndex(static_cast<NumberExpr*>(subExpr->index)->value);
+                return base && idx >= 0 ? &base->element(static_cast<size_t>(idx)) : nullptr;
+            }
+
+            // A computed index can land anywhere in the base; mark it before
+            // collecting the index, which may add siblings and move `base`
+            if (base) base->whole = true;
+            collectValueAccess(subExpr->index, root);
+            return nullptr;
+        }
+        case ExprKind::BinaryOp:
+            collectValueAccess(static_cast<BinaryOpExpr*>(expr)->left, root);
+            collectValueAccess(static_cast<BinaryOpExpr*>(expr)->right, root);
+            break;
+        case ExprKind::UnaryOp:
+            collectValueAccess(static_cast<UnaryOpExpr*>(expr)->operand, root);
+            break;
+        case ExprKind::FunctionCall:
+            for (auto argExpr : static_cast<FunctionCallExpr*>(expr)->arguments) {
+                collectValueAccess(argExpr, root);
+            }
+            break;
+        case ExprKind::Path: {
+            auto pathExpr = static_cast<PathExpr*>(expr);
+            AccessTree* node = pathExpr->base ? collectAccess(pathExpr->base, root) : &root;
+            for (const PathStep& step : pathExpr->steps) {
+                if (!node) break;
+                node = step.kind == PathStepKind::Index ? &node->element(step.index) : &node->member(step.key);
+            }
+            return node;
+        }
+        case ExprKind::Projection: {
+            // Any element can be reached. Names in the filter and element are
+            // relative to the element and record nothing; only paths from the
+            // root inside them (in computed indices) add to the tree.
+            auto projection = static_cast<ProjectionExpr*>(expr);
+            collectValueAccess(projection->source, root);
+            if (projection->filter) collectValueAccess(projection->filter, root);
+            collectValueAccess(projection->element, root);
+            break;
+        }
+        case ExprKind::Number:
+        case ExprKind::String:
+        case ExprKind::Current:
+            break;
+    }
+    return nullptr;
+}
+
+// Values of the nodes of a SharedPaths in one document, filled in by
+// SharedPaths::resolve()
+class ResolvedPaths {
+public:
+    // Resolved value of a node, or nullptr
+    const JSONValue* value(size_t node) const {
+        return resolved[node] ? &values[node] : nullptr;
+    }
+
+private:
+    friend class SharedPaths;
+    std::vector<JSONValue> values;
+    std::vector<char> resolved;
+};
+
+// Document paths shared by a set of expressions. Every path expression
+// (an identifier followed by member accesses and literal subscripts) maps
+// to a node of one prefix tree, so user.scores[0], user.scores[1] and
+// max(user.scores) share the user and user.scores nodes. resolve() walks
+// the tree against a document once; compiled programs then answer each
+// path expression with a single lookup. Paths that do not resolve are left
+// to normal evaluation, which reports the appropriate error. The tree does
+// not change once built, so threads may share it, each resolving it into
+// ResolvedPaths of its own.
+class SharedPaths {
+public:
+    explicit SharedPaths(const std::vector<Expression*>& expressions) {
+        nodes.push_back(Node{0, false, KeyTable::noKey, 0});
+        for (Expression* expr : expressions) {
+            addPaths(expr);
+        }
+    }
+
+    // Resolve every node against `root`; nodes are stored parents first
+    void resolve(const JSONValue& root, ResolvedPaths& out) const {
+        out.values.resize(nodes.size());
+        out.resolved.assign(nodes.size(), false);
+        out.resolved[0] = true;
+        out.values[0] = root;
+        for (size_t i = 1; i < nodes.size(); ++i) {
+            const Node& node = nodes[i];
+            if (!out.resolved[node.parent]) continue;
+            const JSONValue& parent = out.values[node.parent];
+            try {
+                if (node.isIndex) {
+                    if (parent.type == JSONValueType::Array && node.index < parent.arrayValue().size()) {
+                        out.values[i] = parent.arrayValue()[node.index];
+                        out.resolved[i] = true;
+                    }
+                } else if (parent.type == JSONValueType::Object) {
+                    JSONValue member;
+                    if (parent.findMember(node.key, member)) {
+                        out.values[i] = member;
+                        out.resolved[i] = true;
+                    }
+                }
+            } catch (const std::exception&) {
+                // Left unresolved; an expression reading the value from a
+                // damaged cache fails when it reads it itself
+            }
+        }
+    }
+
+    // Node of a path expression, or 0 if `expr` is not one
+    size_t nodeOf(const Expression* expr) const {
+        auto it = nodeOfExpr.find(expr);
+        return it == nodeOfExpr.end() ? 0 : it->second;
+    }
+
+private:
+    struct Node {
+        size_t parent;
+        bool isIndex;
+        KeyId key;
+        size_t index;
+    };
+
+    std::vector<Node> nodes; // nodes[0] is the document root
+    std::unordered_map<const Expression*, size_t> nodeOfExpr;
+    std::unordered_map<std::string, size_t> childOf; // "<parent>.<key>" or "<parent>[<index>]"
+
+    size_t child(size_t parent, bool isIndex, const std::string& key, size_t index) {
+        std::string id = std::to_string(parent) + (isIndex ? "[" + std::to_string(index) : "." + key);
+        auto it = childOf.find(id);
+        if (it != childOf.end()) return it->second;
+        KeyId keyId = isIndex ? KeyTable::noKey : KeyTable::global().intern(key);
+        nodes.push_back(Node{parent, isIndex, keyId, index});
+        childOf[id] = nodes.size() - 1;
+        return nodes.size() - 1;
+    }
+
+    // Node index of a path expression (0 is never returned for one);
+    // other expressions return 0 after their subexpressions are added
+    size_t addPaths(Expression* expr) {
+        size_t node = 0;
+        switch (expr->kind) {
+            case ExprKind::Identifier:
+                node = child(0, false, static_cast<IdentifierExpr*>(expr)->name, 0);
+                break;
+            case ExprKind::MemberAccess: {
+                auto memberExpr = static_cast<MemberAccessExpr*>(expr);
+                size_t base = addPaths(memberExpr->base);
+                if (base) node = child(base, false, memberExpr->member, 0);
+                break;
+            }
+            case ExprKind::Subscript: {
+                auto subExpr = static_cast<SubscriptExpr*>(expr);
+                size_t base = addPaths(subExpr->base);
+                Expression* index = subExpr->index;
+                if (base && index->kind == ExprKind::String) {
+                    node = child(base, false, static_cast<StringExpr*>(index)->value, 0);
+                } else if (base && index->kind == ExprKind::Number &&
+                           arrayIndex(static_cast<NumberExpr*>(index)->value) >= 0) {
+                    int64_t idx = arrayIndex(static_cast<NumberExpr*>(index)->value);
+                    node = child(base, true, std::string(), static_cast<size_t>(idx));
+                } else {
+                    addPaths(index);
+                }
+                break;
+            }
+            case ExprKind::BinaryOp:
+                addPaths(static_cast<BinaryOpExpr*>(expr)->left);
+                addPaths(static_cast<BinaryOpExpr*>(expr)->right);
+                break;
+            case ExprKind::UnaryOp:
+                addPaths(static_cast<UnaryOpExpr*>(expr)->operand);
+                break;
+            case ExprKind::FunctionCall:
+                for (auto argExpr : static_cast<FunctionCallExpr*>(expr)->arguments) {
+                    addPaths(argExpr);
+                }
+                break;
+            case ExprKind::Path: {
+                auto pathExpr = static_cast<PathExpr*>(expr);
+                size_t base = pathExpr->base ? addPaths(pathExpr->base) : 0;
+                if (pathExpr->base && !base) break;
+                node = base;
+                for (const PathStep& step : pathExpr->steps) {
+                    bool isIndex = step.kind == PathStepKind::Index;
+                    node = child(node, isIndex, isIndex ? std::string() : step.key, step.index);
+                }
+                break;
+            }
+            case ExprKind::Projection: {
+                // Paths relative to the element are not shared (Current is
+                // never a node); paths from the root inside it are
+                auto projection = static_cast<ProjectionExpr*>(expr);
+                addPaths(projection->source);
+                if (projection->filter) addPaths(projection->filter);
+                addPaths(projection->element);
+                break;
+            }
+            case ExprKind::Number:
+            case ExprKind::String:
+            case ExprKind::Current:
+                break;
+        }
+        if (node) nodeOfExpr[expr] = node;
+        return node;
+    }
+};
+
+// Built-in functions
+enum class BuiltinFunction : uint8_t {
+    Min,
+    Max,
+    Sum,
+    Avg,
+    Count,
+    Size
+};
+
+inline bool findBuiltin(const std::string& name, BuiltinFunction& function) {
+    if (name == "min") {
+        function = BuiltinFunction::Min;
+    } else if (name == "max") {
+        function = BuiltinFunction::Max;
+    } else if (name == "sum") {
+        function = BuiltinFunction::Sum;
+    } else if (name == "avg") {
+        function = BuiltinFunction::Avg;
+    } else if (name == "count") {
+        function = BuiltinFunction::Count;
+    } else if (name == "size") {
+        function = BuiltinFunction::Size;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// min, max, sum, avg and count, which fold any number of values
+inline bool isAggregate(BuiltinFunction function) {
+    return function != BuiltinFunction::Size;
+}
+
+// Running result of an aggregate function. Arguments are added one at a
+// time: an array argument adds each of its elements as an item, anything
+// else is one item itself. Items of min, max, sum and avg must be numbers;
+// count counts items of any type.
+class Aggregate {
+public:
+    explicit Aggregate(BuiltinFunction function)
+        : function(function),
+          result(function == BuiltinFunction::Min   ? std::numeric_limits<double>::infinity()
+                 : function == BuiltinFunction::Max ? -std::numeric_limits<double>::infinity()
+                                                    : 0.0),
+          items(0) {}
+
+    void addArgument(const JSONValue& arg) {
+        if (arg.type == JSONValueType::Array) { // Array argument
+            JSONArray elements = arg.arrayValue();
+            if (elements.isPacked() && function != BuiltinFunction::Count) {
+                // Packed arrays are reduced with the SIMD kernels
+                const Reductions& reductions = activeReductions();
+                double reduced;
+                switch (function) {
+                    case BuiltinFunction::Min: reduced = reductions.minimum(elements.numbers, elements.size()); break;
+                    case BuiltinFunction::Max: reduced = reductions.maximum(elements.numbers, elements.size()); break;
+                    default: reduced = reductions.sum(elements.numbers, elements.size()); break;
+                }
+                result = combine(result, reduced);
+                items += elements.size();
+                return;
+            }
+            if (function == BuiltinFunction::Count) {
+                items += elements.size();
+                return;
+            }
+
+            // Folded in a local, which the elements' numbers cannot alias
+            double folded = result;
+            for (const auto& element : elements) {
+                if (element.type != JSONValueType::Number) {
+                    throw std::runtime_error(std::string(name(function)) + "() array items must be numbers");
+                }
+                folded = combine(folded, element.numberValue);
+            }
+            result = folded;
+            items += elements.size();
+        } else if (arg.type == JSONValueType::Number || function == BuiltinFunction::Count) { // Single item
+            addItem(arg);
+        } else {
+            throw std::runtime_error(std::string(name(function)) + "() arguments must be numbers or arrays of numbers");
+        }
+    }
+
+    // One element of an array argument
+    void addItem(const JSONValue& item) {
+        if (function != BuiltinFunction::Count) {
+            if (item.type != JSONValueType::Number) {
+                throw std::runtime_error(std::string(name(function)) + "() array items must be numbers");
+            }
+            result = combine(result, item.numberValue);
+        }
+        items++;
+    }
+
+    JSONValue value() const {
+        if (function == BuiltinFunction::Count) {
+            return JSONValue(static_cast<double>(items));
+        }
+        if (function == BuiltinFunction::Avg) {
+            if (items == 0) {
+                throw std::runtime_error("avg() requires at least one number");
+            }
+            return JSONValue(result / static_cast<double>(items));
+        }
+        return JSONValue(result);
+    }
+
+    static const char* name(BuiltinFunction function) {
+        switch (function) {
+            case BuiltinFunction::Min: return "min";
+            case BuiltinFunction::Max: return "max";
+            case BuiltinFunction::Sum: return "sum";
+            case BuiltinFunction::Avg: return "avg";
+            case BuiltinFunction::Count: return "count";
+            default: return "size";
+        }
+    }
+
+private:
+    BuiltinFunction function;
+    double result;
+    size_t items;
+
+    double combine(double folded, double value) const {
+        switch (function) {
+            case BuiltinFunction::Min: return std::min(folded, value);
+            case BuiltinFunction::Max: return std::max(folded, value);
+            default: return folded + value;
+        }
+    }
+};
+
+inline JSONValue callBuiltin(BuiltinFunction function, const JSONValue* args, size_t count) {
+    if (isAggregate(function)) {
+        if (count == 0) {
+            throw std::runtime_error(std::string(Aggregate::name(function)) + "() requires at least one argument");
+        }
+
+        // Fold every number, and every element of array arguments, into
+        // the result
+        Aggregate aggregate(function);
+        for (size_t i = 0; i < count; ++i) {
+            aggregate.addArgument(args[i]);
+        }
+        return aggregate.value();
+    }
+
+    // Check for exactly one argument
+    if (count != 1) {
+        throw std::runtime_error("size() requires exactly one argument");
+    }
+
+    // Get the size of the argument
+    const JSONValue& arg = args[0];
+    if (arg.type == JSONValueType::Object) {
+        return JSONValue(static_cast<double>(arg.objectValue().size()));
+    } else if (arg.type == JSONValueType::Array) {
+        return JSONValue(static_cast<double>(arg.arrayValue().size()));
+    } else if (arg.type == JSONValueType::String) {
+        return JSONValue(static_cast<double>(arg.stringValue().length));
+    } else {
+        throw std::runtime_error("size() argument must be object, array, or string");
+    }
+}
+
+// Result of a comparison operator (see BinaryOpExpr), 1 or 0. Numbers
+// compare by value and strings byte by byte. A number and a string are
+// never equal and cannot be ordered; other values cannot be compared.
+inline double compareValues(char op, const JSONValue& left, const JSONValue& right) {
+    bool comparable = (left.type == JSONValueType::Number || left.type == JSONValueType::String) &&
+                      (right.type == JSONValueType::Number || right.type == JSONValueType::String);
+    if (!comparable) {
+        throw std::runtime_error("Comparison operands must be numbers or strings");
+    }
+    int order;
+    if (left.type != right.type) {
+        if (op != '=' && op != '!') throw std::runtime_error("Cannot order a number and a string");
+        return op == '!' ? 1 : 0;
+    } else if (left.type == JSONValueType::Number) {
+        order = left.numberValue < right.numberValue ? -1 : left.numberValue > right.numberValue ? 1 : 0;
+        if (order == 0 && left.numberValue != right.numberValue) {
+            return op == '!' ? 1 : 0; // NaN
+        }
+    } else {
+        StringRef l = left.stringValue();
+        StringRef r = right.stringValue();
+        size_t common = std::min(l.length, r.length);
+        order = common > 0 ? std::memcmp(l.data, r.data, common) : 0;
+        if (order == 0) order = l.length < r.length ? -1 : l.length > r.length ? 1 : 0;
+    }
+    switch (op) {
+        case '<': return order < 0;
+        case 'L': return order <= 0;
+        case '>': return order > 0;
+        case 'G': return order >= 0;
+        case '=': return order == 0;
+        default: return order != 0;
+    }
+}
+
+// Rewrites a parsed expression before it is compiled. Subexpressions whose
+// operands are all literals are folded into one literal, and chains of an
+// identifier, member accesses and literal subscripts are merged into one
+// PathExpr. Errors every evaluation would hit (division by a literal zero,
+// a negative literal index) are thrown here once instead of per document.
+// Nodes are rewritten in place; new ones are allocated from `arena`. Nodes
+// merged into a path are dropped from the tree, so their names are moved
+// into the path's steps rather than copied.
+class Optimizer {
+public:
+    explicit Optimizer(Arena& arena) : arena(arena) {}
+
+    Expression* optimize(Expression* expr) {
+        switch (expr->kind) {
+            case ExprKind::Number:
+            case ExprKind::String:
+            case ExprKind::Path:
+            case ExprKind::Current:
+                return expr;
+            case ExprKind::Identifier: {
+                PathExpr* path = arena.make<PathExpr>(nullptr, std::vector<PathStep>());
+                path->steps.push_back(
+                    PathStep{PathStepKind::Identifier, std::move(static_cast<IdentifierExpr*>(expr)->name), 0});
+                return path;
+            }
+            case ExprKind::MemberAccess: {
+                auto memberExpr = static_cast<MemberAccessExpr*>(expr);
+                Expression* base = optimize(memberExpr->base);
+                return appendStep(base, PathStep{PathStepKind::Member, std::move(memberExpr->member), 0});
+            }
+            case ExprKind::Subscript: {
+                auto subExpr = static_cast<SubscriptExpr*>(expr);
+                subExpr->base = optimize(subExpr->base);
+                subExpr->index = optimize(subExpr->index);
+                if (subExpr->index->kind == ExprKind::String) {
+                    std::string& key = static_cast<StringExpr*>(subExpr->index)->value;
+                    return appendStep(subExpr->base, PathStep{PathStepKind::Key, std::move(key), 0});
+                }
+                if (subExpr->index->kind == ExprKind::Number) {
+                    int64_t idx = arrayIndex(static_cast<NumberExpr*>(subExpr->index)->value);
+                    if (idx < 0) {
+                        throw std::runtime_error("Negative array index");
+                    }
+                    return appendStep(subExpr->base,
+                                      PathStep{PathStepKind::Index, std::string(), static_cast<size_t>(idx)});
+                }
+                return subExpr;
+            }
+            case ExprKind::BinaryOp: {
+                auto binExpr = static_cast<BinaryOpExpr*>(expr);
+                binExpr->left = optimize(binExpr->left);
+                binExpr->right = optimize(binExpr->right);
+                const NumberExpr* left = numberLiteral(binExpr->left);
+                const NumberExpr* right = numberLiteral(binExpr->right);
+                if (binExpr->op == '/' && right && right->value == 0) {
+                    throw std::runtime_error("Division by zero");
+                }
+                if (isComparison(binExpr->op)) {
+                    // Comparisons that would fail are left to report at evaluation
+                    JSONValue leftValue, rightValue;
+                    if (!literalValue(binExpr->left, leftValue) || !literalValue(binExpr->right, rightValue)) {
+                        return binExpr;
+                    }
+                    try {
+                        return arena.make<NumberExpr>(compareValues(binExpr->op, leftValue, rightValue));
+                    } catch (const std::exception&) {
+                        return binExpr;
+                    }
+                }
+                if (!left || !right) return binExpr;
+                switch (binExpr->op) {
+                    case '+': return arena.make<NumberExpr>(left->value + right->value);
+                    case '-': return arena.make<NumberExpr>(left->value - right->value);
+                    case '*': return arena.make<NumberExpr>(left->value * right->value);
+                    case '/': return arena.make<NumberExpr>(left->value / right->value);
+                    default: return binExpr;
+                }
+            }
+            case ExprKind::UnaryOp: {
+                auto unaryExpr = static_cast<UnaryOpExpr*>(expr);
+                unaryExpr->operand = optimize(unaryExpr->operand);
+                const NumberExpr* operand = numberLiteral(unaryExpr->operand);
+                if (operand && unaryExpr->op == '-') {
+                    return arena.make<NumberExpr>(-operand->value);
+                }
+                return unaryExpr;
+            }
+            case ExprKind::FunctionCall: {
+                auto funcExpr = static_cast<FunctionCallExpr*>(expr);
+                bool literalArgs = true;
+                for (auto& argExpr : funcExpr->arguments) {
+                    argExpr = optimize(argExpr);
+                    literalArgs = literalArgs && (argExpr->kind == ExprKind::Number || argExpr->kind == ExprKind::String);
+                }
+
+                // Calls that would fail are left to report at evaluation
+                BuiltinFunction function;
+                if (!literalArgs || !findBuiltin(funcExpr->functionName, function)) return funcExpr;
+                std::vector<JSONValue> args(funcExpr->arguments.size());
+                for (size_t i = 0; i < args.size(); ++i) {
+                    literalValue(funcExpr->arguments[i], args[i]);
+                }
+                try {
+                    JSONValue result = callBuiltin(function, args.data(), args.size());
+                    return arena.make<NumberExpr>(result.numberValue);
+                } catch (const std::exception&) {
+                    return funcExpr;
+                }
+            }
+            case ExprKind::Projection: {
+                auto projection = static_cast<ProjectionExpr*>(expr);
+                projection->source = optimize(projection->source);
+                if (projection->filter) projection->filter = optimize(projection->filter);
+                projection->element = optimize(projection->element);
+                return projection;
+            }
+        }
+        return expr;
+    }
+
+    static bool isComparison(char op) {
+        return op == '<' || op == 'L' || op == '>' || op == 'G' || op == '=' || op == '!';
+    }
+
+private:
+    Arena& arena;
+
+    static const NumberExpr* numberLiteral(const Expression* expr) {
+        return expr->kind == ExprKind::Number ? static_cast<const NumberExpr*>(expr) : nullptr;
+    }
+
+    // Value of a number or string literal; false for anything else
+    static bool literalValue(const Expression* expr, JSONValue& value) {
+        if (expr->kind == ExprKind::Number) {
+            value = JSONValue(static_cast<const NumberExpr*>(expr)->value);
+        } else if (expr->kind == ExprKind::String) {
+            value = JSONValue(StringRef(static_cast<const StringExpr*>(expr)->value));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // Extend `base` by one step; a path built here is only referenced by
+    // its parent, so it can grow in place
+    Expression* appendStep(Expression* base, PathStep&& step) {
+        if (base->kind != ExprKind::Path) {
+            base = arena.make<PathExpr>(base, std::vector<PathStep>());
+        }
+        static_cast<PathExpr*>(base)->steps.push_back(std::move(step));
+        return base;
+    }
+};
+
+// Bytecode for the evaluation stack machine. Every instruction pushes,
+// pops or replaces values on the stack; a program leaves its result as the
+// only value on it. Projections run as loops: Iterate starts one over an
+// array, and each pass of Next through the body handles one element and
+// hands the result to the innermost aggregate or array being built.
+enum class OpCode : uint8_t {
+    PushNumber,  // numbers[operand]
+    PushString,  // strings[operand]
+    LoadRoot,    // root member with key id `operand`
+    LoadShared,  // shared path node `operand`; if it resolved, skip the next `extra` instructions
+    GetMember,   // replace the top with its member with key id `operand`
+    GetIndex,    // pop index and base, push base[index]
+    WalkPath,    // follow steps[operand] .. steps[operand + extra - 1] from the root or the top
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Negate,
+    Compare,     // pop right and left, push the comparison `operand` (a BinaryOpExpr op) of them
+    Call,        // pop `extra` arguments, push builtin `operand` applied to them
+    Fail,        // throw strings[operand]
+    RequireArray,   // fail unless the top is an array
+    Iterate,        // pop an array and start a loop over its elements
+    Next,           // move the innermost loop to its next element, or end it and jump to `operand`
+    LoadCurrent,    // push the innermost loop's element
+    SkipIfZero,     // pop a filter condition; if it is 0 jump to `operand`
+    Jump,           // jump to `operand`
+    BeginAggregate, // start folding values with builtin `operand`
+    AddArgument,    // pop a value and add it to the innermost aggregate as an argument
+    AddItem,        // pop a value and add it to the innermost aggregate as an array item
+    EndAggregate,   // push the innermost aggregate's result and end it
+    BeginArray,     // start collecting values into an array
+    Append,         // pop a value and add it to the innermost array
+    EndArray        // push the innermost array and end it
+};
+
+struct Instruction {
+    OpCode op;
+    uint32_t operand;
+    uint32_t extra;
+};
+
+// A PathStep with its key interned
+struct CompiledStep {
+    PathStepKind kind;
+    KeyId key;      // Identifier, Member and Key steps
+    uint32_t index; // Index steps
+};
+
+// An expression compiled for the VirtualMachine
+struct Program {
+    std::vector<Instruction> code;
+    std::vector<double> numbers;
+    std::vector<std::string> strings;
+    std::vector<CompiledStep> steps;
+    size_t stackSize = 0;
+};
+
+// Compiles an expression tree into a Program. Operands are emitted before
+// their operator, in the same order the tree would evaluate them, so the
+// program fails with the same error the first failing subexpression would.
+class Compiler {
+public:
+    // With `paths`, path expressions first try their shared node; the
+    // program must then run with those paths resolved against the document
+    static Program compile(const Expression* expr, const SharedPaths* paths = nullptr) {
+        Compiler compiler(paths);
+        compiler.emitExpression(expr, true);
+        return std::move(compiler.program);
+    }
+
+private:
+    Program program;
+    const SharedPaths* paths;
+    int depth = 0;
+
+    explicit Compiler(const SharedPaths* paths) : paths(paths) {}
+
+    void emit(OpCode op, int stackEffect, uint32_t operand = 0, uint32_t extra = 0) {
+        program.code.push_back(Instruction{op, operand, extra});
+        depth += stackEffect;
+        program.stackSize = std::max(program.stackSize, static_cast<size_t>(depth));
+    }
+
+    uint32_t addString(const std::string& value) {
+        program.strings.push_back(value);
+        return static_cast<uint32_t>(program.strings.size() - 1);
+    }
+
+    uint32_t addNumber(double value) {
+        program.numbers.push_back(value);
+        return static_cast<uint32_t>(program.numbers.size() - 1);
+    }
+
+    void emitExpression(const Expression* expr, bool useShared) {
+        size_t node = useShared && paths ? paths->nodeOf(expr) : 0;
+        if (node) {
+            // The normal path walk follows, for documents where the shared
+            // node did not resolve and the walk reports why
+            size_t at = program.code.size();
+            emit(OpCode::LoadShared, 0, static_cast<uint32_t>(node));
+            emitExpression(expr, false);
+            program.code[at].extra = static_cast<uint32_t>(program.code.size() - at - 1);
+            return;
+        }
+
+        switch (expr->kind) {
+            case ExprKind::Number:
+                emit(OpCode::PushNumber, 1, addNumber(static_cast<const NumberExpr*>(expr)->value));
+                break;
+            case ExprKind::String:
+                emit(OpCode::PushString, 1, addString(static_cast<const StringExpr*>(expr)->value));
+                break;
+            case ExprKind::Identifier:
+                emit(OpCode::LoadRoot, 1, KeyTable::global().intern(static_cast<const IdentifierExpr*>(expr)->name));
+                break;
+            case ExprKind::BinaryOp: {
+                auto binExpr = static_cast<const BinaryOpExpr*>(expr);
+                emitExpression(binExpr->left, useShared);
+                emitExpression(binExpr->right, useShared);
+                switch (binExpr->op) {
+                    case '+': emit(OpCode::Add, -1); break;
+                    case '-': emit(OpCode::Subtract, -1); break;
+                    case '*': emit(OpCode::Multiply, -1); break;
+                    case '/': emit(OpCode::Divide, -1); break;
+                    default:
+                        if (Optimizer::isComparison(binExpr->op)) {
+                            emit(OpCode::Compare, -1, static_cast<uint32_t>(binExpr->op));
+                        } else {
+                            emit(OpCode::Fail, -1, addString("Unknown binary operator"));
+                        }
+                        break;
+                }
+                break;
+            }
+            case ExprKind::UnaryOp: {
+                auto unaryExpr = static_cast<const UnaryOpExpr*>(expr);
+                emitExpression(unaryExpr->operand, useShared);
+                if (unaryExpr->op == '-') {
+                    emit(OpCode::Negate, 0);
+                } else {
+                    emit(OpCode::Fail, 0, addString("Unknown unary operator"));
+                }
+                break;
+            }
+            case ExprKind::FunctionCall: {
+                auto funcExpr = static_cast<const FunctionCallExpr*>(expr);
+                BuiltinFunction function;
+                bool known = findBuiltin(funcExpr->functionName, function);
+                if (known && emitFusedCall(funcExpr, function, useShared)) break;
+                for (auto argExpr : funcExpr->arguments) {
+                    emitExpression(argExpr, useShared);
+                }
+
+                // Unknown functions fail only after their arguments evaluated
+                uint32_t argCount = static_cast<uint32_t>(funcExpr->arguments.size());
+                if (known) {
+                    emit(OpCode::Call, 1 - static_cast<int>(argCount), static_cast<uint32_t>(function), argCount);
+                } else {
+                    emit(OpCode::Fail, 1 - static_cast<int>(argCount),
+                         addString("Unknown function: " + funcExpr->functionName));
+                }
+                break;
+            }
+            case ExprKind::Subscript: {
+                auto subExpr = static_cast<const SubscriptExpr*>(expr);
+                emitExpression(subExpr->base, useShared);
+                emitExpression(subExpr->index, useShared);
+                emit(OpCode::GetIndex, -1);
+                break;
+            }
+            case ExprKind::MemberAccess: {
+                auto memberExpr = static_cast<const MemberAccessExpr*>(expr);
+                emitExpression(memberExpr->base, useShared);
+                emit(OpCode::GetMember, 0, KeyTable::global().intern(memberExpr->member));
+                break;
+            }
+            case ExprKind::Path: {
+                auto pathExpr = static_cast<const PathExpr*>(expr);
+                if (pathExpr->base) emitExpression(pathExpr->base, useShared);
+                uint32_t first = static_cast<uint32_t>(program.steps.size());
+                for (const PathStep& step : pathExpr->steps) {
+                    bool isIndex = step.kind == PathStepKind::Index;
+                    KeyId key = isIndex ? KeyTable::noKey : KeyTable::global().intern(step.key);
+                    program.steps.push_back(CompiledStep{step.kind, key, static_cast<uint32_t>(step.index)});
+                }
+                emit(OpCode::WalkPath, pathExpr->base ? 0 : 1, first, static_cast<uint32_t>(pathExpr->steps.size()));
+                break;
+            }
+            case ExprKind::Current:
+                emit(OpCode::LoadCurrent, 1);
+                break;
+            case ExprKind::Projection: {
+                auto projection = static_cast<const ProjectionExpr*>(expr);
+                if (projection->isIdentity()) {
+                    // The source array is already the value
+                    emitExpression(projection->source, useShared);
+                    emit(OpCode::RequireArray, 0);
+                    break;
+                }
+                emit(OpCode::BeginArray, 0);
+                emitLoop(projection, OpCode::Append, useShared);
+                emit(OpCode::EndArray, 1);
+                break;
+            }
+        }
+    }
+
+    // Aggregate calls with a projection among their arguments fold each
+    // projected value into the result as the loop produces it, and size()
+    // of a projection counts them; neither builds the projected array.
+    // Returns false, emitting nothing, for calls to evaluate normally.
+    bool emitFusedCall(const FunctionCallExpr* funcExpr, BuiltinFunction function, bool useShared) {
+        const std::vector<Expression*>& args = funcExpr->arguments;
+        bool projected = false;
+        for (const Expression* argExpr : args) {
+            projected = projected || argExpr->kind == ExprKind::Projection;
+        }
+        if (!projected || (!isAggregate(function) && args.size() != 1)) return false;
+
+        emit(OpCode::BeginAggregate, 0,
+             static_cast<uint32_t>(isAggregate(function) ? function : BuiltinFunction::Count));
+        for (const Expression* argExpr : args) {
+            auto projection = static_cast<const ProjectionExpr*>(argExpr);
+            if (argExpr->kind != ExprKind::Projection || projection->isIdentity()) {
+                // A whole array adds its elements, as any array argument does
+                emitExpression(argExpr, useShared);
+                emit(OpCode::AddArgument, -1);
+            } else {
+                emitLoop(projection, OpCode::AddItem, useShared);
+            }
+        }
+        emit(OpCode::EndAggregate, 1);
+        return true;
+    }
+
+    // Loop over the projection's source, handing each element's value to
+    // `sink`; an element that is itself a projection loops inside the
+    // body, so its values reach the same sink
+    void emitLoop(const ProjectionExpr* projection, OpCode sink, bool useShared) {
+        emitExpression(projection->source, useShared);
+        emit(OpCode::Iterate, -1);
+        uint32_t next = static_cast<uint32_t>(program.code.size());
+        emit(OpCode::Next, 0);
+        if (projection->filter) {
+            emitExpression(projection->filter, useShared);
+            emit(OpCode::SkipIfZero, -1, next);
+        }
+        if (projection->element->kind == ExprKind::Projection) {
+            emitLoop(static_cast<const ProjectionExpr*>(projection->element), sink, useShared);
+        } else {
+            emitExpression(projection->element, useShared);
+            emit(sink, -1);
+        }
+        emit(OpCode::Jump, 0, next);
+        program.code[next].operand = static_cast<uint32_t>(program.code.size());
+    }
+};
+
+// Runs compiled programs. Stack slots are plain JSONValue handles, so a
+// path lookup pushes a 16-byte copy of the handle and arithmetic results
+// live on the stack itself. Loops, aggregates and arrays being built have
+// stacks of their own. Arrays built by projections are kept in the
+// machine's arena until the next run. All of this is kept between runs;
+// one machine is not safe to share between threads.
+class VirtualMachine {
+public:
+    // Runs and instructions are counted into `stats` if given
+    explicit VirtualMachine(Stats* stats = nullptr) : stats(stats) {}
+
+    // `paths` must be the ones `program` was compiled against, resolved
+    // against `root`. String results may point into `program`, and arrays
+    // built by projections into the machine until it runs again.
+    JSONValue run(const Program& program, const JSONValue& root, const ResolvedPaths* paths = nullptr) {
+        if (stack.size() < program.stackSize) {
+            stack.resize(program.stackSize);
+        }
+        // A run that failed may have left any of these behind
+        loops.clear();
+        aggregates.clear();
+        arrayStarts.clear();
+        collected.clear();
+        arrays.reset();
+        JSONValue* sp = stack.data(); // next free slot
+        const Instruction* pc = program.code.data();
+        const Instruction* end = pc + program.code.size();
+        STATS_HOOK(stats, programsRun++);
+        STATS_HOOK(stats, instructions += program.code.size());
+
+        while (pc != end) {
+            const Instruction& ins = *pc++;
+            switch (ins.op) {
+                case OpCode::PushNumber:
+                    *sp++ = JSONValue(program.numbers[ins.operand]);
+                    break;
+                case OpCode::PushString:
+                    *sp++ = JSONValue(StringRef(program.strings[ins.operand]));
+                    break;
+                case OpCode::LoadRoot:
+                    *sp++ = lookupIdentifier(root, ins.operand);
+                    break;
+                case OpCode::LoadShared: {
+                    const JSONValue* shared = paths ? paths->value(ins.operand) : nullptr;
+                    if (shared) {
+                        *sp++ = *shared;
+                        pc += ins.extra;
+                        STATS_HOOK(stats, instructions -= ins.extra);
+                    }
+                    break;
+                }
+                case OpCode::GetMember:
+                    sp[-1] = lookupMember(sp[-1], ins.operand);
+                    break;
+                case OpCode::GetIndex: {
+                    const JSONValue& base = sp[-2];
+                    const JSONValue& index = sp[-1];
+                    JSONValue result;
+                    if (index.type == JSONValueType::Number) {
+                        result = lookupIndex(base, arrayIndex(index.numberValue));
+                    } else if (index.type == JSONValueType::String) {
+                        // A key that was never interned is in no object
+                        result = lookupKey(base, KeyTable::global().find(index.stringValue()));
+                    } else if (base.type == JSONValueType::Array) {
+                        throw std::runtime_error("Array index must be a number");
+                    } else if (base.type == JSONValueType::Object) {
+                        throw std::runtime_error("Object key must be a string");
+                    } else {
+                        throw std::runtime_error("Subscript operator applied to non-array/object");
+                    }
+                    --sp;
+                    sp[-1] = result;
+                    break;
+                }
+                case OpCode::WalkPath: {
+                    const CompiledStep* step = program.steps.data() + ins.operand;
+                    const CompiledStep* last = step + ins.extra;
+                    if (step->kind == PathStepKind::Identifier) {
+                        *sp++ = lookupIdentifier(root, step->key);
+                        ++step;
+                    }
+                    JSONValue& value = sp[-1];
+                    for (; step != last; ++step) {
+                        switch (step->kind) {
+                            case PathStepKind::Identifier:
+                            case PathStepKind::Member: value = lookupMember(value, step->key); break;
+                            case PathStepKind::Key: value = lookupKey(value, step->key); break;
+                            case PathStepKind::Index: value = lookupIndex(value, step->index); break;
+                        }
+                    }
+                    break;
+                }
+                case OpCode::Add:
+                case OpCode::Subtract:
+                case OpCode::Multiply:
+                case OpCode::Divide: {
+                    const JSONValue& left = sp[-2];
+                    const JSONValue& right = sp[-1];
+                    if (left.type != JSONValueType::Number || right.type != JSONValueType::Number) {
+                        throw std::runtime_error("Arithmetic operations require number operands");
+                    }
+                    double result;
+                    if (ins.op == OpCode::Add) {
+                        result = left.numberValue + right.numberValue;
+                    } else if (ins.op == OpCode::Subtract) {
+                        result = left.numberValue - right.numberValue;
+                    } else if (ins.op == OpCode::Multiply) {
+                        result = left.numberValue * right.numberValue;
+                    } else {
+                        if (right.numberValue == 0) throw std::runtime_error("Division by zero");
+                        result = left.numberValue / right.numberValue;
+                    }
+                    --sp;
+                    sp[-1] = JSONValue(result);
+                    break;
+                }
+                case OpCode::Negate:
+                    if (sp[-1].type != JSONValueType::Number) {
+                        throw std::runtime_error("Unary operator requires a number operand");
+                    }
+                    sp[-1] = JSONValue(-sp[-1].numberValue);
+                    break;
+                case OpCode::Call: {
+                    sp -= ins.extra;
+                    *sp = callBuiltin(static_cast<BuiltinFunction>(ins.operand), sp, ins.extra);
+                    ++sp;
+                    break;
+                }
+                case OpCode::Fail:
+                    throw std::runtime_error(program.strings[ins.operand]);
+                case OpCode::Compare:
+                    --sp;
+                    sp[-1] = JSONValue(compareValues(static_cast<char>(ins.operand), sp[-1], sp[0]));
+                    break;
+                case OpCode::RequireArray:
+                    if (sp[-1].type != JSONValueType::Array) {
+                        throw std::runtime_error("Projection requires an array");
+                    }
+                    break;
+                case OpCode::Iterate:
+                    --sp;
+                    if (sp->type != JSONValueType::Array) {
+                        throw std::runtime_error("Projection requires an array");
+                    }
+                    loops.push_back(Loop{sp->arrayValue(), 0, JSONValue()});
+                    break;
+                case OpCode::Next: {
+                    Loop& loop = loops.back();
+                    if (loop.next < loop.elements.size()) {
+                        loop.current = loop.elements[loop.next++];
+                    } else {
+                        loops.pop_back();
+                        jump(pc, program, ins.operand);
+                    }
+                    break;
+                }
+                case OpCode::LoadCurrent:
+                    *sp++ = loops.back().current;
+                    break;
+                case OpCode::SkipIfZero:
+                    --sp;
+                    if (sp->type != JSONValueType::Number) {
+                        throw std::runtime_error("Filter condition must be a number");
+                    }
+                    if (sp->numberValue == 0) jump(pc, program, ins.operand);
+                    break;
+                case OpCode::Jump:
+                    jump(pc, program, ins.operand);
+                    break;
+                case OpCode::BeginAggregate:
+                    aggregates.emplace_back(static_cast<BuiltinFunction>(ins.operand));
+                    break;
+                case OpCode::AddArgument:
+                    aggregates.back().addArgument(*--sp);
+                    break;
+                case OpCode::AddItem:
+                    aggregates.back().addItem(*--sp);
+                    break;
+                case OpCode::EndAggregate:
+                    *sp++ = aggregates.back().value();
+                    aggregates.pop_back();
+                    break;
+                case OpCode::BeginArray:
+                    arrayStarts.push_back(collected.size());
+                    break;
+                case OpCode::Append:
+                    collected.push_back(*--sp);
+                    break;
+                case OpCode::EndArray: {
+                    size_t start = arrayStarts.back();
+                    size_t count = collected.size() - start;
+                    JSONValue* items = arrays.allocateArray<JSONValue>(count);
+                    std::copy(collected.begin() + start, collected.end(), items);
+                    collected.resize(start);
+                    arrayStarts.pop_back();
+                    *sp++ = JSONValue(items, count);
+                    break;
+                }
+            }
+        }
+        return sp[-1];
+    }
+
+    // Path steps, also used by the compile-time queries in static_query.h
+    static JSONValue lookupIdentifier(const JSONValue& root, KeyId name) {
+        JSONValue value;
+        if (root.type != JSONValueType::Object) {
+            throw std::runtime_error("Root is not an object");
+        }
+        if (!root.findMember(name, value)) {
+            throw std::runtime_error("Identifier not found: " + KeyTable::global().name(name).str());
+        }
+        return value;
+    }
+
+    // base.key
+    static JSONValue lookupMember(const JSONValue& base, KeyId key) {
+        JSONValue value;
+        if (base.type != JSONValueType::Object) {
+            throw std::runtime_error("Member access applied to non-object");
+        }
+        if (!base.findMember(key, value)) {
+            throw std::runtime_error("Member not found in object");
+        }
+        return value;
+    }
+
+    // base["key"]
+    static JSONValue lookupKey(const JSONValue& base, KeyId key) {
+        JSONValue value;
+        if (base.type == JSONValueType::Array) {
+            throw std::runtime_error("Array index must be a number");
+        } else if (base.type != JSONValueType::Object) {
+            throw std::runtime_error("Subscript operator applied to non-array/object");
+        }
+        if (!base.findMember(key, value)) {
+            throw std::runtime_error("Key not found in object");
+        }
+        return value;
+    }
+
+    // base[idx]
+    static JSONValue lookupIndex(const JSONValue& base, int64_t idx) {
+        if (base.type == JSONValueType::Object) {
+            throw std::runtime_error("Object key must be a string");
+        } else if (base.type != JSONValueType::Array) {
+            throw std::runtime_error("Subscript operator applied to non-array/object");
+        }
+        if (idx < 0 || static_cast<uint64_t>(idx) >= base.arrayValue().size()) {
+            throw std::runtime_error("Array index out of bounds");
+        }
+        return base.arrayValue()[static_cast<size_t>(idx)];
+    }
+
+private:
+    // A projection's loop over an array
+    struct Loop {
+        JSONArray elements;
+        size_t next;
+        JSONValue current;
+    };
+
+    std::vector<JSONValue> stack;
+    std::vector<Loop> loops;
+    std::vector<Aggregate> aggregates;
+    std::vector<size_t> arrayStarts; // where each array being built starts in `collected`
+    std::vector<JSONValue> collected;
+    Arena arrays;
+    Stats* stats;
+
+    // Continue at instruction `target`. Instructions were counted as if
+    // each ran once, so a jump adds those it repeats and removes those it skips.
+    void jump(const Instruction*& pc, const Program& program, uint32_t target) {
+        const Instruction* to = program.code.data() + target;
+        STATS_HOOK(stats, instructions += pc - to);
+        pc = to;
+    }
+};
+
+// Where a run's results and error messages go. Results arrive as whole
+// lines of text; error messages, one per call, without a newline.
+class ResultSink {
+public:
+    virtual ~ResultSink() {}
+    virtual void write(const char* data, size_t size) = 0;
+    virtual void error(const std::string& message) = 0;
+};
+
+// Keeps results and error messages in the order they arrive, to be passed
+// on to another sink later
+class BufferedSink : public ResultSink {
+public:
+    void write(const char* data, size_t size) override {
+        if (entries.empty() || entries.back().isError) entries.push_back(Entry{false, std::string()});
+        entries.back().text.append(data, size);
+    }
+
+    void error(const std::string& message) override { entries.push_back(Entry{true, message}); }
+
+    void replay(ResultSink& sink) const {
+        for (const Entry& entry : entries) {
+            if (entry.isError) {
+                sink.error(entry.text);
+            } else {
+                sink.write(entry.text.data(), entry.text.size());
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        bool isError;
+        std::string text;
+    };
+    std::vector<Entry> entries;
+};
+
+class JSONWriter {
+public:
+    enum class Style { Spaced, Compact, Pretty };
+
+    explicit JSONWriter(ResultSink* sink = nullptr, Style style = Style::Spaced) : sink(sink), style(style) {
+        if (sink) buffer.reserve(bufferSize);
+    }
+    ~JSONWriter() { flush(); }
+
+    JSONWriter(const JSONWriter&) = delete;
+    JSONWriter& operator=(const JSONWriter&) = delete;
+
+    // One result: the value and a newline
+    void result(const JSONValue& value) {
+        // A value that fails to be read, from a damaged cache, leaves
+        // nothing of itself behind
+        size_t start = buffer.size();
+        try {
+            write(value);
+        } catch (...) {
+            buffer.resize(start);
+            throw;
+        }
+        buffer += '\n';
+        if (sink && buffer.size() >= bufferSize) flush();
+    }
+
+    void write(const JSONValue& value) { writeValue(value); }
+
+    // Text that is not JSON, copied as is
+    void raw(StringRef text) { buffer.append(text.data, text.length); }
+
+    const std::string& text() const { return buffer; }
+    void clear() { buffer.clear(); }
+
+    // Hand the buffer to the sink
+    void flush() {
+        if (!sink || buffer.empty()) return;
+        sink->write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    // An error message for the sink, after the results before it
+    void error(const std::string& message) {
+        flush();
+        if (sink) sink->error(message);
+    }
+
+private:
+    static const size_t bufferSize = 1 << 18;
+
+    ResultSink* sink;
+    Style style;
+    std::string buffer;
+
+    // Containers being written, innermost last, with the index of the
+    // next child to write
+    struct Frame {
+        JSONValue container;
+        size_t next;
+    };
+    std::vector<Frame> frames;
+
+    // Containers are tracked on `frames` rather than by recursion, so any
+    // depth the parser accepts can be written back out
+    void writeValue(JSONValue value) {
+        frames.clear();
+        while (true) {
+            // Write a scalar or an empty container, or open a container
+            // and go on with its first child
+            size_t depth = frames.size();
+            switch (value.type) {
+                case JSONValueType::Null:
+                    buffer += "null";
+                    break;
+                case JSONValueType::Number:
+                    writeNumber(value.numberValue);
+                    break;
+                case JSONValueType::String:
+                    writeString(value.stringValue());
+                    break;
+                case JSONValueType::Array:
+                    openBracket('[');
+                    if (value.packed) {
+                        // Numbers only, so nothing below them to track
+                        for (size_t i = 0; i < value.length; ++i) {
+                            separate(i, depth + 1);
+                            writeNumber(value.numbersPtr[i]);
+                        }
+                        closeBracket(']', value.length, depth);
+                    } else if (value.length == 0) {
+                        closeBracket(']', 0, depth);
+                    } else {
+                        frames.push_back(Frame{value, 0});
+                    }
+                    break;
+                case JSONValueType::Object:
+                    openBracket('{');
+                    if (value.objectValue().size() == 0) {
+                        closeBracket('}', 0, depth);
+                    } else {
+                        frames.push_back(Frame{value, 0});
+                    }
+                    break;
+            }
+
+            // Go on with the next child of the innermost container,
+            // closing every container that has none left
+            while (true) {
+                if (frames.empty()) return;
+                Frame& frame = frames.back();
+                depth = frames.size();
+                if (frame.container.type == JSONValueType::Array) {
+                    if (frame.next < frame.container.length) {
+                        separate(frame.next, depth);
+                        value = frame.container.arrayValue()[frame.next++];
+                        break;
+                    }
+                    closeBracket(']', frame.container.length, depth - 1);
+                } else {
+                    size_t size = frame.container.objectValue().size();
+                    if (frame.next < size) {
+                        separate(frame.next, depth);
+                        writeString(KeyTable::global().name(frame.container.memberKey(frame.next)));
+                        buffer += style == Style::Compact ? ":" : ": ";
+                        value = frame.container.memberValue(frame.next++);
+                        break;
+                    }
+                    closeBracket('}', size, depth - 1);
+                }
+                frames.pop_back();
+            }
+        }
+    }
+
+    void writeNumber(double number) {
+        char text[32];
+        buffer.append(text, formatNumberText(number, text));
+    }
+
+    void openBracket(char bracket) {
+        buffer += bracket;
+        if (style == Style::Spaced) buffer += ' ';
+    }
+
+    // Before the member or element at `index`, which sits at `depth`
+    void separate(size_t index, size_t depth) {
+        if (index > 0) buffer += style == Style::Spaced ? ", " : ",";
+        if (style == Style::Pretty) newline(depth);
+    }
+
+    void closeBracket(char bracket, size_t count, size_t depth) {
+        if (style == Style::Spaced) {
+            buffer += ' ';
+        } else if (style == Style::Pretty && count > 0) {
+            newline(depth);
+        }
+        buffer += bracket;
+    }
+
+    void newline(size_t depth) {
+        buffer += '\n';
+        buffer.append(depth * 2, ' ');
+    }
+
+    // Quoted, with quotes, backslashes and control characters escaped;
+    // runs of ordinary characters are copied in one go
+    void writeString(StringRef str) {
+        static const char hex[] = "0123456789abcdef";
+        buffer += '"';
+        const char* run = str.data;
+        const char* end = str.data + str.length;
+        for (const char* p = str.data; p < end; ++p) {
+            unsigned char c = static_cast<unsigned char>(*p);
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            buffer.append(run, p);
+            run = p + 1;
+            switch (c) {
+                case '"': buffer += "\\\""; break;
+                case '\\': buffer += "\\\\"; break;
+                case '\b': buffer += "\\b"; break;
+                case '\f': buffer += "\\f"; break;
+                case '\n': buffer += "\\n"; break;
+                case '\r': buffer += "\\r"; break;
+                case '\t': buffer += "\\t"; break;
+                default:
+                    buffer += "\\u00";
+                    buffer += hex[c >> 4];
+                    buffer += hex[c & 0xF];
+            }
+        }
+        buffer.append(run, end);
+        buffer += '"';
+    }
+};
+
+// Prefix for messages about the expression at `index` when several
+// expressions are evaluated in one run
+inline std::string expressionLabel(size_t index, size_t count) {
+    return count > 1 ? "Expression " + std::to_string(index + 1) + ": " : std::string();
+}
+
+// Expressions compiled once against the paths they share. Nothing in it
+// changes afterwards, so threads may evaluate the same set at once, each
+// with ResolvedPaths and a VirtualMachine of its own.
+struct CompiledSet {
+    SharedPaths paths;
+    std::vector<Program> programs;
+
+    explicit CompiledSet(const std::vector<Expression*>& expressions) : paths(expressions) {
+        programs.reserve(expressions.size());
+        for (Expression* expr : expressions) {
+            programs.push_back(Compiler::compile(expr, &paths));
+        }
+    }
+};
+
+// Parses newline-delimited records one at a time and evaluates a compiled
+// set of expressions against each, reusing one arena and parser for all
+// records. Not thread-safe: concurrent users each need their own, but they
+// may share the set.
+class RecordEvaluator {
+public:
+    // `access` is the union of the expressions' paths for lazy parsing,
+    // or nullptr to parse every record completely. Phases and counts go
+    // to `stats` if given.
+    RecordEvaluator(const CompiledSet& set, const AccessTree* access, Stats* stats = nullptr)
+        : set(set), access(access), stats(stats), parser(nullptr, 0, arena, stats), vm(stats) {}
+
+    // Parse one record and resolve the set's paths against it, replacing
+    // the previous record. A failure is reported to `out` as an error and
+    // returns false.
+    bool parse(StringRef record, size_t line, JSONWriter& out) {
+        STATS_HOOK(stats, records++);
+        arena.reset();
+        parser.reset(record.data, record.length);
+        try {
+            parsed = access ? parser.parse(*access) : parser.parse();
+            STATS_HOOK(stats, lap(Stats::Parse));
+        } catch (const std::exception& ex) {
+            out.error("Line " + std::to_string(line) + ": JSON parsing error: " + ex.what());
+            return false;
+        }
+        set.paths.resolve(parsed, resolved);
+        return true;
+    }
+
+    // Evaluate every expression against one record, writing one result
+    // line per expression to `out` and an error for each failure. Returns
+    // false if anything failed.
+    bool evaluate(StringRef record, size_t line, JSONWriter& out) {
+        if (!parse(record, line, out)) return false;
+        bool ok = true;
+        for (size_t i = 0; i < set.programs.size(); ++i) {
+            try {
+                JSONValue result = vm.run(set.programs[i], parsed, &resolved);
+                STATS_HOOK(stats, lap(Stats::Evaluate));
+                out.result(result);
+                STATS_HOOK(stats, lap(Stats::Output));
+            } catch (const std::exception& ex) {
+                out.error("Line " + std::to_string(line) + ": " + expressionLabel(i, set.programs.size()) +
+                          "Evaluation error: " + ex.what());
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    // The record parsed last and the set's paths resolved against it
+    const JSONValue& root() const { return parsed; }
+    const ResolvedPaths& paths() const { return resolved; }
+
+    // The arena records are parsed into
+    const Arena& recordArena() const { return arena; }
+
+private:
+    const CompiledSet& set;
+    const AccessTree* access;
+    Stats* stats;
+    Arena arena;
+    JSONParser parser;
+    JSONValue parsed;
+    ResolvedPaths resolved;
+    VirtualMachine vm;
+};
+
+inline bool isBlankRecord(StringRef record) {
+    return skipWhitespaceScalar(record.data, record.data + record.length) == record.data + record.length;
+}
+
+// Evaluate a compiled set against each record of a newline-delimited JSON
+// input read from `fd`, writing one result per line to `sink`. Records are
+// parsed one at a time into an arena that is reset in between, so memory
+// stays constant. A record that fails to parse or evaluate is reported to
+// `sink` with its line number and the run continues. Returns false if
+// any record failed.
+inline bool evaluateRecords(int fd, const CompiledSet& set, const AccessTree* access, ResultSink& sink,
+                            JSONWriter::Style style, Stats* stats = nullptr) {
+    RecordReader reader(fd);
+    RecordEvaluator evaluator(set, access, stats);
+    JSONWriter out(&sink, style);
+    bool failed = false;
+    StringRef record;
+    STATS_HOOK(stats, cpuPerPhase = false);
+    while (reader.next(record)) {
+        STATS_HOOK(stats, lap(Stats::Read));
+        // Blank lines separate nothing and are skipped
+        if (isBlankRecord(record)) continue;
+        if (!evaluator.evaluate(record, reader.lineNumber(), out)) {
+            failed = true;
+        }
+    }
+    STATS_HOOK(stats, lap(Stats::Read));
+    out.flush();
+    STATS_HOOK(stats, lap(Stats::Output));
+    STATS_HOOK(stats, bytesRead += reader.bytesRead());
+    STATS_HOOK(stats, countArena(evaluator.recordArena()));
+    return !failed;
+}
+
+// Fixed-size pool of worker threads with one task deque per worker.
+// Tasks are spread round-robin; a worker runs tasks from the back of its
+// own deque and, when that is empty, steals from the front of the others'
+// so a slow task does not hold up the work queued behind it. Tasks may
+// submit further tasks.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threadCount) : nextQueue(0), pending(0), stopping(false) {
+        threadCount = std::max<size_t>(threadCount, 1);
+        for (size_t i = 0; i < threadCount; ++i) {
+            queues.emplace_back(new TaskQueue());
+        }
+        for (size_t i = 0; i < threadCount; ++i) {
+            threads.emplace_back(&ThreadPool::run, this, i);
+        }
+    }
+
+    // Finishes all queued tasks, then joins the workers
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return threads.size(); }
+
+    void submit(std::function<void()> task) {
+        size_t index = nextQueue++ % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            pending++;
+        }
+        wake.notify_one();
+    }
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextQueue;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    size_t pending; // queued tasks not yet taken, guarded by sleepMutex
+    bool stopping;
+
+    void run(size_t index) {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wake.wait(lock, [this] { return pending > 0 || stopping; });
+                if (pending == 0) return; // stopping and drained
+                pending--;
+            }
+
+            // A task is reserved for us; find it, own queue first
+            std::function<void()> task;
+            while (!take(index, task)) {
+                std::this_thread::yield();
+            }
+            task();
+        }
+    }
+
+    bool take(size_t index, std::function<void()>& task) {
+        {
+            TaskQueue& own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues.size(); ++offset) {
+            TaskQueue& victim = *queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Outcome of one expression evaluated as a task of its own: the result
+// line, or the message of the error it failed with
+struct ExpressionResult {
+    std::string text;
+    std::string error;
+    bool failed = false;
+};
+
+// Evaluates every program of `set` against `root` as a pool task of its
+// own, program i filling results[i]; the task finishing last calls `done`.
+// `paths` must be the set's paths resolved against `root`, and everything
+// passed by reference must outlive the tasks.
+inline void evaluateEach(const CompiledSet& set, const JSONValue& root, const ResolvedPaths& paths,
+                         JSONWriter::Style style, std::vector<ExpressionResult>& results, ThreadPool& pool,
+                         std::function<void()> done) {
+    results.assign(set.programs.size(), ExpressionResult());
+    auto remaining = std::make_shared<std::atomic<size_t>>(set.programs.size());
+    for (size_t i = 0; i < set.programs.size(); ++i) {
+        pool.submit([&set, &root, &paths, style, &results, i, remaining, done]() {
+            static thread_local VirtualMachine vm;
+            try {
+                JSONWriter out(nullptr, style);
+                out.result(vm.run(set.programs[i], root, &paths));
+                results[i].text = out.text();
+            } catch (const std::exception& ex) {
+                results[i].error = ex.what();
+                results[i].failed = true;
+            }
+            if (--*remaining == 0) done();
+        });
+    }
+}
+
+// Evaluate a compiled set against one document, writing the results to
+// `out` in order and an error for each expression that fails. With several
+// threads and expressions, each expression is evaluated as a task of its
+// own. Returns false if any expression failed.
+inline bool evaluateDocument(const CompiledSet& set, const JSONValue& root, size_t threadCount, JSONWriter& out,
+                             JSONWriter::Style style, Stats* stats = nullptr) {
+    // Resolve the expressions' shared path prefixes once
+    ResolvedPaths paths;
+    set.paths.resolve(root, paths);
+    STATS_HOOK(stats, lap(Stats::Evaluate));
+    size_t count = set.programs.size();
+    bool failed = false;
+    if (threadCount > 1 && count > 1) {
+        // One task per expression; results are still written in order
+        std::vector<ExpressionResult> results;
+        {
+            ThreadPool pool(std::min(threadCount, count));
+            evaluateEach(set, root, paths, style, results, pool, []() {});
+        }
+        for (size_t i = 0; i < count; ++i) {
+            out.raw(results[i].text);
+            if (results[i].failed) {
+                out.error(expressionLabel(i, count) + "Evaluation error: " + results[i].error);
+                failed = true;
+            }
+        }
+    } else {
+        VirtualMachine vm(stats);
+        for (size_t i = 0; i < count; ++i) {
+            try {
+                JSONValue result = vm.run(set.programs[i], root, &paths);
+                STATS_HOOK(stats, lap(Stats::Evaluate));
+                out.result(result);
+            } catch (const std::exception& ex) {
+                out.error(expressionLabel(i, count) + "Evaluation error: " + ex.what());
+                failed = true;
+            }
+            STATS_HOOK(stats, lap(Stats::Output));
+        }
+    }
+    out.flush();
+    STATS_HOOK(stats, lap(Stats::Output));
+    return !failed;
+}
+
+// Parallel version of evaluateRecords. The compiled set is shared by all
+// tasks. The reader thread cuts the input into chunks of whole records;
+// each chunk is parsed and evaluated as one pool task into a buffer of
+// its own, and chunks are passed on to `sink` strictly in input order, so
+// the results and errors are identical to a sequential run. A chunk
+// holding a single record, one too large to share a chunk, is parsed by
+// one task and its expressions are evaluated as a task each. At most a
+// few chunks per thread are in flight, which bounds memory.
+inline bool evaluateRecordsParallel(int fd, const CompiledSet& set, const AccessTree* access, size_t threadCount,
+                                    ResultSink& sink, JSONWriter::Style style) {
+    struct Chunk {
+        std::string text;
+        std::vector<std::pair<size_t, size_t>> records; // offset, length
+        std::vector<size_t> lines;
+        BufferedSink buffered;
+        JSONWriter out; // into `buffered`
+        bool failed = false;
+        // A single-record chunk keeps the parsed record here while its
+        // expressions are evaluated one per task
+        std::unique_ptr<RecordEvaluator> evaluator;
+        std::vector<ExpressionResult> results;
+        std::promise<void> finished;
+        std::future<void> done;
+
+        explicit Chunk(JSONWriter::Style style) : out(&buffered, style), done(finished.get_future()) {}
+    };
+    const size_t chunkBytes = 1 << 20;
+
+    // Declared before the pool so the pool drains before chunks are freed
+    std::deque<std::unique_ptr<Chunk>> inFlight;
+    ThreadPool pool(threadCount);
+    const size_t maxInFlight = pool.size() * 4;
+    bool failed = false;
+
+    // Pass on the oldest chunk once its tasks have finished
+    auto flushOldest = [&]() {
+        Chunk& chunk = *inFlight.front();
+        chunk.done.get();
+        chunk.out.flush();
+        chunk.buffered.replay(sink);
+        for (size_t i = 0; i < chunk.results.size(); ++i) {
+            const ExpressionResult& result = chunk.results[i];
+            sink.write(result.text.data(), result.text.size());
+            if (result.failed) {
+                sink.error("Line " + std::to_string(chunk.lines[0]) + ": " +
+                           expressionLabel(i, chunk.results.size()) + "Evaluation error: " + result.error);
+                failed = true;
+            }
+        }
+        failed = failed || chunk.failed;
+        inFlight.pop_front();
+    };
+
+    auto evaluateChunk = [&set, access, style, &pool](Chunk* task) {
+        if (task->records.size() == 1 && set.programs.size() > 1) {
+            task->evaluator.reset(new RecordEvaluator(set, access));
+            StringRef record(task->text.data(), task->records[0].second);
+            if (!task->evaluator->parse(record, task->lines[0], task->out)) {
+                task->failed = true;
+                task->finished.set_value();
+                return;
+            }
+            evaluateEach(set, task->evaluator->root(), task->evaluator->paths(), style, task->results, pool,
+                         [task]() { task->finished.set_value(); });
+            return;
+        }
+        RecordEvaluator evaluator(set, access);
+        for (size_t i = 0; i < task->records.size(); ++i) {
+            StringRef record(task->text.data() + task->records[i].first, task->records[i].second);
+            if (!evaluator.evaluate(record, task->lines[i], task->out)) {
+                task->failed = true;
+            }
+        }
+        task->finished.set_value();
+    };
+
+    auto dispatch = [&](std::unique_ptr<Chunk> chunk) {
+        Chunk* task = chunk.get();
+        pool.submit([task, evaluateChunk]() {
+            try {
+                evaluateChunk(task);
+            } catch (...) {
+                task->finished.set_exception(std::current_exception());
+            }
+        });
+        inFlight.push_back(std::move(chunk));
+        if (inFlight.size() >= maxInFlight) {
+            flushOldest();
+        }
+    };
+
+    RecordReader reader(fd);
+    std::unique_ptr<Chunk> chunk(new Chunk(style));
+    StringRef record;
+    while (reader.next(record)) {
+        if (isBlankRecord(record)) continue;
+        chunk->records.emplace_back(chunk->text.size(), record.length);
+        chunk->lines.push_back(reader.lineNumber());
+        chunk->text.append(record.data, record.length);
+        if (chunk->text.size() >= chunkBytes) {
+            dispatch(std::move(chunk));
+            chunk.reset(new Chunk(style));
+        }
+    }
+    if (!chunk->records.empty()) {
+        dispatch(std::move(chunk));
+    }
+    while (!inFlight.empty()) {
+        flushOldest();
+    }
+    return !failed;
+}
+
+// A parsed document and the memory its values live in
+struct ParsedDocument {
+    std::unique_ptr<MappedFile> file;     // parsed strings may point into it,
+    std::string text;                     // or into this for documents parsed from memory;
+    std::unique_ptr<DocumentCache> cache; // a document loaded from a cache lives in it
+    Arena arena;
+    JSONValue root;
+};
+
+// Expressions compiled to be evaluated together, with the union of the
+// paths they read for lazy parsing
+struct CompiledQuerySet {
+    Arena arena; // the optimized expressions, which `set` was compiled from
+    AccessTree access;
+    std::unique_ptr<CompiledSet> set;
+};
+
+// An expression compiled on its own, or the error it failed with
+struct CompiledExpression {
+    Program program;
+    std::string error; // empty if the expression compiled
+};
+
+inline void compileExpression(const std::string& text, CompiledExpression& compiled) {
+    Arena arena;
+    Expression* expr = nullptr;
+    try {
+        Lexer lexer(text);
+        Parser parser(lexer, arena);
+        expr = parser.parseExpression();
+    } catch (const std::exception& ex) {
+        compiled.error = std::string("Expression parsing error: ") + ex.what();
+        return;
+    }
+    try {
+        Optimizer optimizer(arena);
+        compiled.program = Compiler::compile(optimizer.optimize(expr));
+    } catch (const std::exception& ex) {
+        compiled.error = std::string("Expression error: ") + ex.what();
+    }
+}
+
+#endif // JSON_EVAL_INTERNAL_H
@@ -0,0 +1,670 @@
+// The json_eval command, a client of the library interface in json_eval.h:
+// the options, the messages on stderr, and the query server.
+
+#include "json_eval.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Writes all of `size` bytes to `fd`; false if the descriptor fails
+static bool writeAll(int fd, const char* data, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        ssize_t count = write(fd, data + written, size - written);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        written += static_cast<size_t>(count);
+    }
+    return true;
+}
+
+// Results go to stdout and error messages to stderr. The library hands
+// over the results before an error, so the two stay in order.
+class ConsoleOutput : public json_eval::Output {
+public:
+    void write(const char* data, size_t size) override { writeAll(STDOUT_FILENO, data, size); }
+    void error(const std::string& message) override { std::cerr << message << std::endl; }
+};
+
+// Input errors are the command's own; the others carry their kind in the message
+static void printError(const json_eval::Error& error) {
+    std::cerr << (error.kind() == json_eval::Error::Kind::Input ? "Error: " : "") << error.what() << std::endl;
+}
+
+// Moves the lines of `input` that are complete to `lines`, without their
+// line ends; blank lines are dropped
+static void takeLines(std::string& input, std::vector<std::string>& lines) {
+    size_t start = 0;
+    for (size_t newline; (newline = input.find('\n', start)) != std::string::npos; start = newline + 1) {
+        size_t end = newline > start && input[newline - 1] == '\r' ? newline - 1 : newline;
+        if (input.find_first_not_of(" \t\r", start) < end) {
+            lines.push_back(input.substr(start, end - start));
+        }
+    }
+    input.erase(0, start);
+}
+
+// Fixed set of threads running tasks in the order they are queued
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t threadCount) : stopping(false) {
+        for (size_t i = 0; i < std::max<size_t>(threadCount, 1); ++i) {
+            threads.emplace_back(&WorkerPool::run, this);
+        }
+    }
+
+    // Finishes all queued tasks, then joins the workers
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> tasks;
+    bool stopping;
+
+    void run() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return !tasks.empty() || stopping; });
+                if (tasks.empty()) return; // stopping and drained
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+// Parsed documents kept between server queries, keyed by path. A document
+// is parsed again when its file's size or modification time change;
+// queries still holding the previous version keep it alive until they
+// finish. Files are read rather than mapped, so one truncated while it is
+// being served cannot crash the server. Once the files of the documents
+// kept add up to more than the limit, the least recently used documents
+// are dropped; the one used last is kept whatever its size.
+class DocumentStore {
+public:
+    explicit DocumentStore(size_t maxBytes) : maxBytes(maxBytes), totalBytes(0) {}
+
+    // Current version of the document at `path`, parsed if needed
+    json_eval::Document get(const std::string& path) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            throw json_eval::Error(json_eval::Error::Kind::Input, "Cannot open JSON file: " + path);
+        }
+
+        std::shared_ptr<Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(path);
+            if (it == entries.end()) {
+                it = entries.emplace(path, std::make_shared<Entry>()).first;
+                recent.push_front(path);
+                it->second->position = recent.begin();
+            } else {
+                recent.splice(recent.begin(), recent, it->second->position);
+            }
+            entry = it->second;
+        }
+
+        // Queries for a document that is being parsed wait for it
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        if (entry->document && entry->info.st_size == info.st_size &&
+            entry->info.st_mtim.tv_sec == info.st_mtim.tv_sec &&
+            entry->info.st_mtim.tv_nsec == info.st_mtim.tv_nsec) {
+            return *entry->document;
+        }
+
+        json_eval::LoadOptions options;
+        options.map = false;
+        entry->document.reset(new json_eval::Document(json_eval::Document::load(path, options)));
+        entry->info = info;
+        size_t bytes = static_cast<size_t>(info.st_size);
+        std::lock_guard<std::mutex> storeLock(mutex);
+        auto it = entries.find(path);
+        if (it == entries.end() || it->second != entry) return *entry->document; // dropped while parsing
+        totalBytes += bytes - entry->bytes;
+        entry->bytes = bytes;
+        while (totalBytes > maxBytes && recent.back() != path) {
+            auto victim = entries.find(recent.back());
+            totalBytes -= victim->second->bytes;
+            entries.erase(victim);
+            recent.pop_back();
+        }
+        return *entry->document;
+    }
+
+private:
+    struct Entry {
+        std::mutex mutex;
+        std::unique_ptr<json_eval::Document> document; // copies share the parsed data
+        struct stat info; // of the file the document was parsed from
+        size_t bytes = 0; // counted in totalBytes, guarded by the store's mutex
+        std::list<std::string>::iterator position;
+    };
+
+    size_t maxBytes;
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+    std::list<std::string> recent; // paths of the entries, most recently used first
+    size_t totalBytes;
+};
+
+// An expression compiled for the server, or the error it failed with
+struct CompiledQuery {
+    std::unique_ptr<json_eval::Query> query; // null if the expression did not compile
+    std::string error;
+};
+
+// Compiled expressions shared between server queries, keyed by their
+// text. Expressions that fail to compile are cached with their error.
+// When the cache is full it is emptied, which bounds its memory when
+// clients send many different expressions.
+class ExpressionCache {
+public:
+    std::shared_ptr<const CompiledQuery> get(const std::string& text) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(text);
+            if (it != entries.end()) return it->second;
+        }
+
+        // Compiled outside the lock; a concurrent query for the same text
+        // may compile it too, and either result is kept
+        std::shared_ptr<CompiledQuery> compiled = std::make_shared<CompiledQuery>();
+        try {
+            compiled->query.reset(new json_eval::Query(json_eval::Query::compile(text)));
+        } catch (const json_eval::Error& ex) {
+            compiled->error = ex.what();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.size() >= maxEntries) entries.clear();
+        entries[text] = compiled;
+        return compiled;
+    }
+
+private:
+    static const size_t maxEntries = 4096;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<const CompiledQuery>> entries;
+};
+
+// Answers queries against documents it keeps parsed in memory. Each query
+// is one line holding a JSON file path and an expression separated by a
+// tab; each answer is one line holding the result, or "error: " and the
+// message. Answers on a connection come in the order of its queries.
+class QueryServer {
+public:
+    // Answers are written in `format`, which must keep them on one line.
+    // Documents are kept up to `storeBytes` of JSON files.
+    explicit QueryServer(json_eval::Format format = json_eval::Format::Spaced, size_t storeBytes = size_t(1) << 30)
+        : format(format), documents(storeBytes) {}
+
+    // Answer the queries read from `in` on `out` until `in` is closed
+    void serve(int in, int out) {
+        std::string input;
+        std::vector<std::string> queries;
+        bool reading = true;
+        while (reading) {
+            char buffer[65536];
+            ssize_t count = read(in, buffer, sizeof(buffer));
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0) throw std::runtime_error("Cannot read input");
+            input.append(buffer, static_cast<size_t>(count));
+            if (count == 0) {
+                // A last line without a newline still counts
+                reading = false;
+                input += '\n';
+            }
+            queries.clear();
+            takeLines(input, queries);
+            for (const std::string& query : queries) {
+                std::string answer = respond(query) + "\n";
+                if (!writeAll(out, answer.data(), answer.size())) return; // the client went away
+            }
+            if (input.size() > maxQuery) {
+                std::string answer = tooLong() + "\n";
+                writeAll(out, answer.data(), answer.size());
+                return;
+            }
+        }
+    }
+
+    // Accept clients on a Unix domain socket at `path` and answer their
+    // queries on a pool of `threadCount` threads. One thread waits on all
+    // connections and hands each query to the pool as it arrives, so an
+    // idle client holds no worker. Only returns if the socket fails; the
+    // return value is the process exit status.
+    int listen(const std::string& path, size_t threadCount) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Error: Socket path too long: " << path << std::endl;
+            return 1;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listener, SOMAXCONN) != 0 || pipe(wake) != 0) {
+            std::cerr << "Error: Cannot listen on socket: " << path << std::endl;
+            if (listener >= 0) close(listener);
+            return 1;
+        }
+        fcntl(listener, F_SETFL, O_NONBLOCK);
+        fcntl(wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake[1], F_SETFL, O_NONBLOCK);
+
+        // A client that disconnects early must not end the server
+        signal(SIGPIPE, SIG_IGN);
+        bool accepted;
+        {
+            // Finishes the queries in flight before the pipe is closed
+            WorkerPool pool(threadCount);
+            accepted = dispatch(listener, pool);
+        }
+        std::cerr << "Error: Cannot " << (accepted ? "wait for" : "accept") << " connections on socket: " << path
+                  << std::endl;
+        close(listener);
+        close(wake[0]);
+        close(wake[1]);
+        return 1;
+    }
+
+private:
+    // A client socket. Only the dispatching thread reads and writes it;
+    // pool tasks hand their answers over through `done`.
+    struct Connection {
+        int fd;
+        std::string input;   // received bytes not yet forming a whole query
+        bool reading = true; // until the client closes its end
+        bool failed = false;
+        size_t queries = 0;  // queries handed to the pool so far
+
+        std::mutex mutex; // guards the rest
+        std::map<size_t, std::string> done; // answers waiting for earlier ones
+        size_t answered = 0; // answers moved to `output`
+        std::string output; // answers in order, not yet written
+
+        explicit Connection(int fd) : fd(fd) {}
+    };
+
+    // Queries and answer bytes a connection may have outstanding before
+    // the server stops reading from it
+    static const size_t maxQueued = 64;
+    static const size_t maxOutput = 1 << 20;
+
+    // Longest query line; a longer one is answered with an error and
+    // ends the connection, so a client cannot make the server buffer
+    // without bound
+    static const size_t maxQuery = 1 << 20;
+
+    static std::string tooLong() { return "error: Query longer than " + std::to_string(maxQuery) + " bytes"; }
+
+    json_eval::Format format;
+    DocumentStore documents;
+    ExpressionCache expressions;
+    int wake[2]; // written by tasks to wake the dispatching thread
+
+    // Waits on the listener and every connection; false if accepting
+    // fails, true if waiting does
+    bool dispatch(int listener, WorkerPool& pool) {
+        std::vector<std::shared_ptr<Connection>> connections;
+        std::vector<pollfd> polled;
+        while (true) {
+            polled.assign({pollfd{listener, POLLIN, 0}, pollfd{wake[0], POLLIN, 0}});
+            for (const auto& connection : connections) {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                short events = 0;
+                if (connection->reading && connection->queries - connection->answered < maxQueued &&
+                    connection->output.size() < maxOutput) {
+                    events |= POLLIN;
+                }
+                if (!connection->output.empty()) events |= POLLOUT;
+                polled.push_back(pollfd{connection->fd, events, 0});
+            }
+            if (poll(polled.data(), polled.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                return true;
+            }
+
+            char drained[256];
+            while (read(wake[0], drained, sizeof(drained)) > 0) {
+            }
+            for (size_t i = 0; i < connections.size(); ++i) {
+                Connection& connection = *connections[i];
+                if (polled[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) receive(connections[i], pool);
+                send(connection);
+            }
+
+            // Close connections that are done with, or broken
+            size_t kept = 0;
+            for (size_t i = 0; i < connections.size(); ++i) {
+                Connection& connection = *connections[i];
+                bool finished;
+                {
+                    std::lock_guard<std::mutex> lock(connection.mutex);
+                    finished = connection.failed ||
+                               (!connection.reading && connection.answered == connection.queries &&
+                                connection.output.empty());
+                }
+                if (finished) {
+                    close(connection.fd);
+                } else {
+                    connections[kept++] = connections[i];
+                }
+            }
+            connections.resize(kept);
+
+            while (polled[0].revents & POLLIN) {
+                int client = accept(listener, nullptr, nullptr);
+                if (client < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    return false;
+                }
+                fcntl(client, F_SETFL, O_NONBLOCK);
+                connections.push_back(std::make_shared<Connection>(client));
+            }
+        }
+    }
+
+    // Read what the client sent and queue each whole query line; a last
+    // line without a newline counts once the client closes its end. A
+    // line past maxQuery is answered with an error after the queries
+    // before it, and nothing more is read.
+    void receive(const std::shared_ptr<Connection>& connection, WorkerPool& pool) {
+        char buffer[65536];
+        ssize_t count = read(connection->fd, buffer, sizeof(buffer));
+        if (count < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) connection->failed = true;
+            return;
+        }
+        connection->input.append(buffer, static_cast<size_t>(count));
+        if (count == 0) {
+            connection->reading = false;
+            if (!connection->input.empty()) connection->input += '\n';
+        }
+
+        std::vector<std::string> queries;
+        takeLines(connection->input, queries);
+        for (const std::string& query : queries) {
+            size_t index = connection->queries++;
+            pool.submit([this, connection, index, query]() { finish(*connection, index, respond(query) + "\n"); });
+        }
+        if (connection->input.size() > maxQuery) {
+            connection->reading = false;
+            connection->input.clear();
+            finish(*connection, connection->queries++, tooLong() + "\n");
+        }
+    }
+
+    // Hand over the answer to query `index`, waking the dispatching
+    // thread if answers can now be written
+    void finish(Connection& connection, size_t index, const std::string& answer) {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        connection.done[index] = answer;
+        bool ready = false;
+        for (auto next = connection.done.begin();
+             next != connection.done.end() && next->first == connection.answered;
+             next = connection.done.erase(next)) {
+            connection.output += next->second;
+            connection.answered++;
+            ready = true;
+        }
+        if (ready && write(wake[1], "", 1) < 0) {
+            // The pipe is full, so the dispatching thread will wake anyway
+        }
+    }
+
+    // Write as much of the answers as the socket takes without blocking
+    void send(Connection& connection) {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        if (connection.output.empty()) return;
+        ssize_t count = write(connection.fd, connection.output.data(), connection.output.size());
+        if (count > 0) {
+            connection.output.erase(0, static_cast<size_t>(count));
+        } else if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            connection.failed = true; // the client went away
+        }
+    }
+
+    // The answer to one query, without the newline
+    std::string respond(const std::string& query) {
+        size_t tab = query.find('\t');
+        if (tab == std::string::npos) {
+            return "error: Expected a JSON file and an expression separated by a tab";
+        }
+        std::shared_ptr<const CompiledQuery> compiled = expressions.get(query.substr(tab + 1));
+        if (!compiled->query) {
+            return "error: " + compiled->error;
+        }
+        try {
+            return compiled->query->evaluate(documents.get(query.substr(0, tab)), format);
+        } catch (const std::exception& ex) {
+            return std::string("error: ") + ex.what();
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    const char* usage =
+        "Usage: ./json_eval [--lazy] [--ndjson] [--cache] [--compact | --pretty] [--threads N] [--expressions FILE]\n"
+        "                   [--stats] [--max-depth N] <json_file> [<expression>...]\n"
+        "       ./json_eval --serve [--socket PATH] [--compact] [--threads N] [--max-depth N] [--store-limit MB]";
+
+    // Parse options
+    bool lazy = false;
+    bool ndjson = false;
+    bool useCache = false;
+    bool serve = false;
+    bool showStats = false;
+    json_eval::Format format = json_eval::Format::Spaced;
+    std::string socketPath;
+    size_t threads = 1;
+    bool threadsGiven = false;
+    size_t storeLimit = 0;
+    std::vector<std::string> expressionTexts;
+    bool expressionsFromStdin = false;
+    int argi = 1;
+    for (; argi < argc && std::strncmp(argv[argi], "--", 2) == 0; ++argi) {
+        std::string option = argv[argi];
+        if (option == "--lazy") {
+            lazy = true;
+        } else if (option == "--ndjson") {
+            ndjson = true;
+        } else if (option == "--cache") {
+            // Reuse <json_file>.cache, writing it first if needed
+            useCache = true;
+        } else if (option == "--compact") {
+            format = json_eval::Format::Compact;
+        } else if (option == "--pretty") {
+            format = json_eval::Format::Pretty;
+        } else if (option == "--serve") {
+            serve = true;
+        } else if (option == "--stats") {
+            // Phase times and counts on stderr after the results
+            showStats = true;
+        } else if (option == "--socket" && argi + 1 < argc) {
+            socketPath = argv[++argi];
+        } else if (option == "--threads" && argi + 1 < argc) {
+            // 0 means one thread per core
+            threads = std::strtoul(argv[++argi], nullptr, 10);
+            if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+            threadsGiven = true;
+        } else if (option == "--store-limit" && argi + 1 < argc) {
+            // Megabytes of JSON files the server keeps parsed
+            storeLimit = std::strtoul(argv[++argi], nullptr, 10);
+            if (storeLimit == 0) {
+                std::cerr << "Error: --store-limit must be at least 1" << std::endl;
+                return 1;
+            }
+        } else if (option == "--max-depth" && argi + 1 < argc) {
+            // Deepest nesting of arrays and objects to accept
+            size_t depth = std::strtoul(argv[++argi], nullptr, 10);
+            if (depth == 0) {
+                std::cerr << "Error: --max-depth must be at least 1" << std::endl;
+                return 1;
+            }
+            json_eval::setMaxDepth(depth);
+        } else if (option == "--expressions" && argi + 1 < argc) {
+            // One expression per line; "-" reads them from stdin
+            std::string path = argv[++argi];
+            std::ifstream file;
+            if (path != "-") {
+                file.open(path);
+                if (!file) {
+                    std::cerr << "Error: Cannot open expressions file: " << path << std::endl;
+                    return 1;
+                }
+            }
+            expressionsFromStdin = expressionsFromStdin || path == "-";
+            std::istream& in = path == "-" ? std::cin : file;
+            std::string line;
+            while (std::getline(in, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.find_first_not_of(" \t") != std::string::npos) {
+                    expressionTexts.push_back(line);
+                }
+            }
+        } else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return 1;
+        }
+    }
+
+    // Server mode takes its files and expressions from the queries; socket
+    // clients are served on one thread per core unless told otherwise
+    if (serve) {
+        if (argi < argc || lazy || ndjson || useCache || showStats || !expressionTexts.empty() ||
+            format == json_eval::Format::Pretty) {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+        QueryServer server(format, storeLimit ? storeLimit << 20 : size_t(1) << 30);
+        if (socketPath.empty()) {
+            try {
+                server.serve(STDIN_FILENO, STDOUT_FILENO);
+            } catch (const std::exception& ex) {
+                std::cerr << "Error: " << ex.what() << std::endl;
+                return 1;
+            }
+            return 0;
+        }
+        return server.listen(socketPath, threadsGiven ? threads : std::max(1u, std::thread::hardware_concurrency()));
+    }
+    if (argi >= argc || !socketPath.empty() || storeLimit) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+    std::string jsonFilename = argv[argi++];
+    for (; argi < argc; ++argi) {
+        expressionTexts.push_back(argv[argi]);
+    }
+    if (expressionTexts.empty()) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+    if (jsonFilename == "-" && expressionsFromStdin) {
+        std::cerr << "Error: stdin is already used for expressions" << std::endl;
+        return 1;
+    }
+    if (useCache && (ndjson || jsonFilename == "-")) {
+        std::cerr << "Error: --cache needs a single JSON document in a file" << std::endl;
+        return 1;
+    }
+    if (showStats && (!json_eval::Statistics::available() || threads > 1)) {
+        std::cerr << (json_eval::Statistics::available() ? "Error: --stats needs a single thread"
+                                                         : "Error: --stats is not available in this build")
+                  << std::endl;
+        return 1;
+    }
+    std::unique_ptr<json_eval::Statistics> stats(showStats ? new json_eval::Statistics() : nullptr);
+
+    ConsoleOutput output;
+    json_eval::EvaluateOptions options;
+    options.format = format;
+    options.threads = threads;
+    options.lazy = lazy;
+    options.statistics = stats.get();
+    try {
+        // Compile every expression before reading the document, so lazy
+        // mode knows which paths to build
+        json_eval::QuerySet queries = json_eval::QuerySet::compile(expressionTexts, stats.get());
+        bool ok;
+        if (ndjson) {
+            // Stream records from the file, or from stdin for "-"
+            int fd = jsonFilename == "-" ? STDIN_FILENO : open(jsonFilename.c_str(), O_RDONLY);
+            if (fd < 0) {
+                std::cerr << "Error: Cannot open JSON file: " << jsonFilename << std::endl;
+                return 1;
+            }
+            ok = queries.evaluateRecords(fd, output, options);
+            if (fd != STDIN_FILENO) close(fd);
+        } else {
+            json_eval::LoadOptions load;
+            load.lazyFor = lazy ? &queries : nullptr;
+            load.cache = useCache;
+            load.statistics = stats.get();
+            json_eval::Document document = json_eval::Document::load(jsonFilename, load);
+            if (document.cacheUse() == json_eval::Document::CacheUse::Failed) {
+                std::cerr << "Warning: Cannot write cache file: " << jsonFilename << ".cache" << std::endl;
+            }
+            ok = queries.evaluate(document, output, options);
+        }
+        if (stats) {
+            std::cerr << stats->json() << std::endl;
+        }
+        return ok ? 0 : 1;
+    } catch (const json_eval::Error& ex) {
+        printError(ex);
+        return 1;
+    }
+}
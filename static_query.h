@@ -0,0 +1,283 @@
+// Queries fixed at build time, written as C++ expressions instead of text.
+//
+//     #include "static_query.h"
+//
+//     using namespace static_query;
+//     static const auto spread = max(path("user", "scores")) - min(path("user", "scores"));
+//     JSONValue result = spread(root);
+//
+// Each query is a tree of small templates whose shape (the operators, the
+// functions and the kind of every path step) is part of its type, so the
+// compiler inlines the whole evaluation: a path becomes a fixed sequence
+// of object and array lookups, an operator a check and one instruction.
+// Member names are interned once, when the query is constructed. Nothing
+// is lexed, parsed or compiled per call.
+//
+// Results and errors are those of the same expression text run through
+// Parser, Optimizer and VirtualMachine. Steps of a path:
+//     path("user", "scores", 0)     user.scores[0]
+//     path("user", key("a b"))      user["a b"]
+// Functions: min, max, sum, avg over numbers and arrays of numbers, count
+// and size. Operators: + - * / and unary -, with numbers or other queries;
+// projections, filters and comparisons have no static form.
+// Queries are immutable once built and can be shared between threads.
+
+#ifndef JSON_EVAL_STATIC_QUERY_H
+#define JSON_EVAL_STATIC_QUERY_H
+
+#include "json_eval_internal.h"
+
+#include <tuple>
+#include <type_traits>
+
+namespace static_query {
+
+// Base of every query type, so the operators only apply to queries
+struct Query {};
+
+template <typename T>
+struct IsQuery : std::is_base_of<Query, typename std::decay<T>::type> {};
+
+// Steps after the identifier a path starts with
+
+// .name
+struct Member {
+    KeyId key;
+    explicit Member(const char* name) : key(KeyTable::global().intern(StringRef(name, std::strlen(name)))) {}
+    JSONValue apply(const JSONValue& value) const { return VirtualMachine::lookupMember(value, key); }
+};
+
+// ["name"]
+struct Key {
+    KeyId key;
+    explicit Key(const char* name) : key(KeyTable::global().intern(StringRef(name, std::strlen(name)))) {}
+    JSONValue apply(const JSONValue& value) const { return VirtualMachine::lookupKey(value, key); }
+};
+
+// [index]
+struct Index {
+    int index;
+    explicit Index(int index) : index(index) {
+        if (index < 0) throw std::runtime_error("Negative array index");
+    }
+    JSONValue apply(const JSONValue& value) const { return VirtualMachine::lookupIndex(value, index); }
+};
+
+inline Key key(const char* name) {
+    return Key(name);
+}
+
+// Step type for each argument of path(): names are members, integers indices
+inline Member makeStep(const char* name) {
+    return Member(name);
+}
+inline Key makeStep(Key step) {
+    return step;
+}
+inline Index makeStep(int index) {
+    return Index(index);
+}
+
+// identifier.step.step...
+template <typename... Steps>
+class Path : public Query {
+public:
+    Path(const char* identifier, Steps... steps)
+        : identifier(KeyTable::global().intern(StringRef(identifier, std::strlen(identifier)))), steps(steps...) {}
+
+    JSONValue operator()(const JSONValue& root) const {
+        return walk<0>(VirtualMachine::lookupIdentifier(root, identifier));
+    }
+
+private:
+    KeyId identifier;
+    std::tuple<Steps...> steps;
+
+    template <size_t I>
+    typename std::enable_if<I == sizeof...(Steps), JSONValue>::type walk(const JSONValue& value) const {
+        return value;
+    }
+
+    template <size_t I>
+    typename std::enable_if<(I < sizeof...(Steps)), JSONValue>::type walk(const JSONValue& value) const {
+        return walk<I + 1>(std::get<I>(steps).apply(value));
+    }
+};
+
+template <typename... Steps>
+Path<decltype(makeStep(std::declval<Steps>()))...> path(const char* identifier, Steps... steps) {
+    return Path<decltype(makeStep(std::declval<Steps>()))...>(identifier, makeStep(steps)...);
+}
+
+// A number in a query
+class Literal : public Query {
+public:
+    explicit Literal(double value) : value(value) {}
+    JSONValue operator()(const JSONValue&) const { return JSONValue(value); }
+
+private:
+    double value;
+};
+
+// Operands of operators: queries as they are, numbers as literals
+template <typename T>
+typename std::enable_if<IsQuery<T>::value, const T&>::type operand(const T& query) {
+    return query;
+}
+
+template <typename T>
+typename std::enable_if<std::is_arithmetic<T>::value, Literal>::type operand(T number) {
+    return Literal(static_cast<double>(number));
+}
+
+template <typename T>
+struct Operand {
+    typedef typename std::decay<decltype(operand(std::declval<T>()))>::type type;
+};
+
+template <char Op, typename Left, typename Right>
+class Binary : public Query {
+public:
+    Binary(Left left, Right right) : left(left), right(right) {}
+
+    JSONValue operator()(const JSONValue& root) const {
+        JSONValue l = left(root);
+        JSONValue r = right(root);
+        if (l.type != JSONValueType::Number || r.type != JSONValueType::Number) {
+            throw std::runtime_error("Arithmetic operations require number operands");
+        }
+        switch (Op) {
+            case '+': return JSONValue(l.numberValue + r.numberValue);
+            case '-': return JSONValue(l.numberValue - r.numberValue);
+            case '*': return JSONValue(l.numberValue * r.numberValue);
+            default:
+                if (r.numberValue == 0) throw std::runtime_error("Division by zero");
+                return JSONValue(l.numberValue / r.numberValue);
+        }
+    }
+
+private:
+    Left left;
+    Right right;
+};
+
+template <typename Operand>
+class Negate : public Query {
+public:
+    explicit Negate(Operand operand) : value(operand) {}
+
+    JSONValue operator()(const JSONValue& root) const {
+        JSONValue result = value(root);
+        if (result.type != JSONValueType::Number) {
+            throw std::runtime_error("Unary operator requires a number operand");
+        }
+        return JSONValue(-result.numberValue);
+    }
+
+private:
+    Operand value;
+};
+
+// Defined when at least one side is a query and the other a query or a number
+template <char Op, typename Left, typename Right>
+struct BinaryFor
+    : std::enable_if<(IsQuery<Left>::value || IsQuery<Right>::value) &&
+                         (IsQuery<Left>::value || std::is_arithmetic<Left>::value) &&
+                         (IsQuery<Right>::value || std::is_arithmetic<Right>::value),
+                     Binary<Op, typename Operand<Left>::type, typename Operand<Right>::type>> {};
+
+template <typename Left, typename Right>
+typename BinaryFor<'+', Left, Right>::type operator+(const Left& left, const Right& right) {
+    return typename BinaryFor<'+', Left, Right>::type(operand(left), operand(right));
+}
+
+template <typename Left, typename Right>
+typename BinaryFor<'-', Left, Right>::type operator-(const Left& left, const Right& right) {
+    return typename BinaryFor<'-', Left, Right>::type(operand(left), operand(right));
+}
+
+template <typename Left, typename Right>
+typename BinaryFor<'*', Left, Right>::type operator*(const Left& left, const Right& right) {
+    return typename BinaryFor<'*', Left, Right>::type(operand(left), operand(right));
+}
+
+template <typename Left, typename Right>
+typename BinaryFor<'/', Left, Right>::type operator/(const Left& left, const Right& right) {
+    return typename BinaryFor<'/', Left, Right>::type(operand(left), operand(right));
+}
+
+template <typename T>
+typename std::enable_if<IsQuery<T>::value, Negate<T>>::type operator-(const T& value) {
+    return Negate<T>(value);
+}
+
+// Indices 0..N-1 as a type, for expanding a tuple into an argument list
+template <size_t... I>
+struct Indices {};
+
+template <size_t N, size_t... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct MakeIndices<0, I...> {
+    typedef Indices<I...> type;
+};
+
+// function(argument, ...), evaluated by the same builtin as in expressions
+template <BuiltinFunction Function, typename... Arguments>
+class Call : public Query {
+public:
+    explicit Call(Arguments... arguments) : arguments(arguments...) {}
+
+    JSONValue operator()(const JSONValue& root) const {
+        return call(root, typename MakeIndices<sizeof...(Arguments)>::type());
+    }
+
+private:
+    std::tuple<Arguments...> arguments;
+
+    template <size_t... I>
+    JSONValue call(const JSONValue& root, Indices<I...>) const {
+        const JSONValue values[] = {std::get<I>(arguments)(root)...};
+        return callBuiltin(Function, values, sizeof...(I));
+    }
+};
+
+template <typename... Arguments>
+Call<BuiltinFunction::Min, typename Operand<Arguments>::type...> min(const Arguments&... arguments) {
+    static_assert(sizeof...(Arguments) > 0, "min() requires at least one argument");
+    return Call<BuiltinFunction::Min, typename Operand<Arguments>::type...>(operand(arguments)...);
+}
+
+template <typename... Arguments>
+Call<BuiltinFunction::Max, typename Operand<Arguments>::type...> max(const Arguments&... arguments) {
+    static_assert(sizeof...(Arguments) > 0, "max() requires at least one argument");
+    return Call<BuiltinFunction::Max, typename Operand<Arguments>::type...>(operand(arguments)...);
+}
+
+template <typename... Arguments>
+Call<BuiltinFunction::Sum, typename Operand<Arguments>::type...> sum(const Arguments&... arguments) {
+    static_assert(sizeof...(Arguments) > 0, "sum() requires at least one argument");
+    return Call<BuiltinFunction::Sum, typename Operand<Arguments>::type...>(operand(arguments)...);
+}
+
+template <typename... Arguments>
+Call<BuiltinFunction::Avg, typename Operand<Arguments>::type...> avg(const Arguments&... arguments) {
+    static_assert(sizeof...(Arguments) > 0, "avg() requires at least one argument");
+    return Call<BuiltinFunction::Avg, typename Operand<Arguments>::type...>(operand(arguments)...);
+}
+
+template <typename... Arguments>
+Call<BuiltinFunction::Count, typename Operand<Arguments>::type...> count(const Arguments&... arguments) {
+    static_assert(sizeof...(Arguments) > 0, "count() requires at least one argument");
+    return Call<BuiltinFunction::Count, typename Operand<Arguments>::type...>(operand(arguments)...);
+}
+
+template <typename Argument>
+Call<BuiltinFunction::Size, typename Operand<Argument>::type> size(const Argument& argument) {
+    return Call<BuiltinFunction::Size, typename Operand<Argument>::type>(operand(argument));
+}
+
+} // namespace static_query
+
+#endif // JSON_EVAL_STATIC_QUERY_H
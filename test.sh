@@ -32,6 +32,9 @@ declare -a expressions=(
   '(user.scores[0] * 0.5) + (user.scores[1] * 0.3) + (user.scores[2] * 0.2)'
   'size(matrix[0])'
   'numbers[-1]'
+  'numbers[4294967296]'
+  'numbers[1e20 * size(numbers)]'
+  'numbers[1.5]'
   'flags.isActive'
   'user.name + " Smith"'
   'matrix[3][0]'
@@ -42,6 +45,38 @@ declare -a expressions=(
   'size(user.name, user.age)'
   'numbers[1 + 1]'
   'user.nickname'
+  '1e3 + 2.5E-1'
+  'numbers[4] * 1e-1'
+  'size(numbers) * 2e+2'
+  'user["address"]["city"]'
+  'size("abc") * (2 + 3)'
+  'numbers[10 / 5]'
+  '1 / (2 - 2)'
+  'products[1]'
+  'sum(user.scores)'
+  'avg(numbers, 5)'
+  'avg(emptyArray)'
+  'sum(products)'
+  'products[*].price'
+  'products[?price > 10].name'
+  'sum(products[*].price)'
+  'avg(products[?price < 25].price)'
+  'count(products[?name != "Gadget"])'
+  'max(matrix[*][*])'
+  'matrix[*][1]'
+  'numbers[?@ >= 30]'
+  'size(products[?price > 100])'
+  'user.age >= 30'
+  'user.name == "Alice"'
+  'count(numbers, 5)'
+  '(products[?id == 2])[0].name'
+  'numbers[*] * 2'
+  'user[*]'
+  'products[?name].id'
+  'sum(products[*].name)'
+  'user.age < "x"'
+  '@'
+  'user.age = 30'
 )
 
 echo "-----------------------------------"
@@ -52,3 +87,159 @@ for expr in "${expressions[@]}"; do
   ./json_eval test.json "$expr"
   echo "-----------------------------------"
 done
+
+# Lazy mode builds only the paths an expression reaches
+declare -a lazy_expressions=(
+  'user.name'
+  'products[2].price + products[0].price'
+  'max(user.scores) - min(user.scores)'
+  'size(matrix[1])'
+  'numbers[1 + 1]'
+  'nested.level1.level2'
+  'user.nickname'
+  'sum(products[?id > 1].price)'
+)
+
+for expr in "${lazy_expressions[@]}"; do
+  echo "Expression (lazy): $expr"
+  ./json_eval --lazy test.json "$expr"
+  echo "-----------------------------------"
+done
+
+# A later duplicate key replaces the earlier value, in lazy mode as when
+# the whole document is parsed
+echo "Expressions (duplicate keys): a, b; lazy a, b; lazy a"
+dupFile=$(mktemp)
+printf '{"a": 1, "a": 2, "b": 3}' > "$dupFile"
+./json_eval "$dupFile" 'a' 'b' 2>&1
+./json_eval --lazy "$dupFile" 'a' 'b' 2>&1
+./json_eval --lazy "$dupFile" 'a' 2>&1
+rm -f "$dupFile"
+echo "-----------------------------------"
+
+# NDJSON mode evaluates the expression against every record; records that
+# fail are reported with their line number and the run continues
+declare -a ndjson_expressions=(
+  'user.name'
+  'max(user.scores)'
+  'id * 10'
+)
+
+for expr in "${ndjson_expressions[@]}"; do
+  echo "Expression (ndjson): $expr"
+  ./json_eval --ndjson test.ndjson "$expr" 2>&1
+  echo "-----------------------------------"
+done
+
+# Batch evaluation on several threads keeps the input order, error messages included
+echo "Expression (ndjson, 3 threads): user.name"
+./json_eval --ndjson --threads 3 test.ndjson 'user.name' 2>&1
+echo "-----------------------------------"
+
+# With several expressions, a lone record or a document is evaluated one
+# expression per task, and results still come out in expression order
+echo "Expressions (ndjson, 2 threads, one record): sum(a), b, a[0]"
+printf '{"a": [1, 2]}\n' | ./json_eval --ndjson --threads 2 - 'sum(a)' 'b' 'a[0]' 2>&1
+echo "-----------------------------------"
+echo "Expressions (2 threads): user.name, unknownVar, max(user.scores)"
+./json_eval --threads 2 test.json 'user.name' 'unknownVar' 'max(user.scores)' 2>&1
+echo "-----------------------------------"
+
+# Several expressions against one parsed document, from arguments and stdin
+echo "Expressions (batch): user.name, user.scores[0], max(user.scores), unknownVar, size(user.address)"
+./json_eval test.json 'user.name' 'user.scores[0]' 'max(user.scores)' 'unknownVar' 'size(user.address)' 2>&1
+echo "-----------------------------------"
+echo "Expressions (batch from stdin): user.age, products[0].name"
+printf 'user.age\nproducts[0].name\n' | ./json_eval --expressions - test.json 2>&1
+echo "-----------------------------------"
+
+# Errors in constant subexpressions are reported once, before any record
+echo "Expression (ndjson): id / (1 - 1)"
+./json_eval --ndjson test.ndjson 'id / (1 - 1)' 2>&1
+echo "-----------------------------------"
+
+# A cached document gives the same results as a parsed one, both on the run
+# that writes the cache and on the run that reads it
+rm -f test.json.cache
+for run in write read; do
+  echo "Expressions (cache $run): user.name, products[1], sum(user.scores), emptyArray"
+  ./json_eval --cache test.json 'user.name' 'products[1]' 'sum(user.scores)' 'emptyArray' 2>&1
+  echo "-----------------------------------"
+done
+
+# A damaged cache is not trusted: here the root's pointer is made to point
+# past the end of the file, and the document is parsed again
+root=$(od -An -t u8 -j 64 -N 8 test.json.cache | tr -d ' ')
+printf '\377\377\377\377\377\377\377\177' | dd of=test.json.cache bs=1 seek=$((root + 8)) conv=notrunc 2>/dev/null
+echo "Expressions (damaged cache): user.name, products[1]"
+./json_eval --cache test.json 'user.name' 'products[1]' 2>&1
+echo "-----------------------------------"
+
+# Damage below the root is only found when it is read, and fails the
+# expressions that reach it: here the first member of the root, user, is
+# made to point past the end of the rewritten cache
+root=$(od -An -t u8 -j 64 -N 8 test.json.cache | tr -d ' ')
+object=$(od -An -t u8 -j $((root + 8)) -N 8 test.json.cache | tr -d ' ')
+printf '\377\377\377\377\377\377\377\177' | dd of=test.json.cache bs=1 seek=$((object + 24)) conv=notrunc 2>/dev/null
+echo "Expressions (damaged cache member): user.name, products[1]"
+./json_eval --cache test.json 'user.name' 'products[1]' 2>&1
+echo "-----------------------------------"
+rm -f test.json.cache
+
+# Server mode answers one query per line, keeping documents and compiled
+# expressions between queries
+echo "Queries (serve): user.name, max(user.scores), user.name, missing.json, 1 +, unknownVar, \"abc, \"ab\\, user.age"
+printf 'test.json\tuser.name\ntest.json\tmax(user.scores)\ntest.json\tuser.name\nmissing.json\tuser\ntest.json\t1 +\ntest.json\tunknownVar\ntest.json\t"abc\ntest.json\t"ab\\\ntest.json\tuser.age\n' | timeout 10 ./json_eval --serve 2>&1
+echo "-----------------------------------"
+
+# A query line over 1 MB is answered with an error and ends the server
+echo "Queries (serve, line too long): user.age, 2 MB expression, user.name"
+{
+  printf 'test.json\tuser.age\ntest.json\t'
+  head -c 2000000 /dev/zero | tr '\0' 'x'
+  printf '\ntest.json\tuser.name\n'
+} | timeout 10 ./json_eval --serve 2>&1
+echo "-----------------------------------"
+
+# Output styles, string escaping and full number precision
+echo "Expression (compact): products[0], matrix, emptyArray"
+./json_eval --compact test.json 'products[0]' 'matrix' 'emptyArray' 2>&1
+echo "-----------------------------------"
+echo "Expression (pretty): user.address, emptyObject"
+./json_eval --pretty test.json 'user.address' 'emptyObject' 2>&1
+echo "-----------------------------------"
+echo "Expression (ndjson): s, n"
+printf '{"s": "say \\"hi\\" \\\\ tab\there", "n": [0.1, 1e21, -2.5e-7, 12345678901, 0.30000000000000004]}\n' |
+  ./json_eval --ndjson - 's' 'n' 2>&1
+echo "-----------------------------------"
+
+# Stats go to stderr after the results; timings and memory vary between
+# runs, so only the counts are compared
+echo "Expressions (stats): user.name, sum(user.scores), then lazily, then ndjson"
+countsOnly() {
+  sed -E 's/"phases": .*"total": \{[^}]*\}, //; s/, "peak_rss_kb": [0-9]+//'
+}
+./json_eval --stats test.json 'user.name' 'sum(user.scores)' 2>&1 | countsOnly
+./json_eval --stats --lazy test.json 'user.name' 'sum(user.scores)' 2>&1 | countsOnly
+printf '{"a": 1}\n\n{"a": [2, 3]}\n' | ./json_eval --stats --ndjson - 'a' 2>&1 | countsOnly
+echo "-----------------------------------"
+
+# Deep nesting is parsed and written without recursion, up to --max-depth;
+# expressions nested too deeply are rejected before they are walked
+echo "Deep nesting: 150000 levels, then with --max-depth 200000, then deep expressions"
+deepFile=$(mktemp)
+{
+  printf '{"a": '
+  head -c 150000 /dev/zero | tr '\0' '['
+  printf '1'
+  head -c 150000 /dev/zero | tr '\0' ']'
+  printf ', "b": 2}'
+} > "$deepFile"
+./json_eval "$deepFile" 'b' 2>&1
+./json_eval --max-depth 200000 "$deepFile" 'b' 'size(a)' 2>&1
+./json_eval --max-depth 200000 --compact "$deepFile" 'a' 2>&1 | wc -c
+rm -f "$deepFile"
+./json_eval test.json "$(head -c 2000 /dev/zero | tr '\0' '(')1$(head -c 2000 /dev/zero | tr '\0' ')')" 2>&1
+./json_eval test.json "$(head -c 5000 /dev/zero | tr '\0' '-')1" 2>&1
+./json_eval test.json "-(-(-(-(-(-(-(-1)))))))" 2>&1
+echo "-----------------------------------"